@@ -0,0 +1,303 @@
+#ifndef LIB_DERP_CHUNKED_MATCHER_HPP
+#define LIB_DERP_CHUNKED_MATCHER_HPP
+
+#include "Generator.hpp"
+#include "Language.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace derp
+{
+
+// Matches one large input against a regular grammar on several threads. The
+// derivatives of the grammar are tabled once, as Generator tables them, and the input
+// is split into chunks. Every chunk is run from every state of the table at once (runs
+// that reach the same state merge, which they soon do in most grammars), giving a map
+// from the state a chunk starts in to the state it ends in. Only the first chunk has a
+// known start, and the maps of the rest are chained after it, in order, to find where
+// the whole input ends.
+//
+// Grammars whose derivatives do not fit the table (those with nested, truly
+// context-free parts) are matched on the calling thread by the derivative engine, as
+// are inputs too small to be worth splitting.
+template <typename L>
+class ChunkedMatcher
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    // threads defaults to the number of hardware threads; maxStates and maxNodes bound
+    // the table as they do for Generator
+    explicit ChunkedMatcher(const L& language, unsigned int threads = 0, std::size_t maxStates = 1024, std::size_t maxNodes = 256);
+    ~ChunkedMatcher();
+
+    ChunkedMatcher(const ChunkedMatcher<L>&) = delete;
+    ChunkedMatcher<L>& operator= (const ChunkedMatcher<L>&) = delete;
+
+    bool matches(const char* input, std::size_t size);
+
+    bool matches(const std::string& input)
+    {
+        return matches(input.data(), input.size());
+    }
+
+    // Whether the grammar fit the table, so inputs are matched in chunks
+    bool regular() const { return !table.empty(); }
+
+    // States in the table, including the one nothing matches from
+    std::size_t states() const { return accepting.size(); }
+
+    unsigned int threads() const { return static_cast<unsigned int>(workers.size()) + 1; }
+
+private:
+    // Inputs are only split into chunks of at least this many bytes
+    static const std::size_t MIN_CHUNK = 1 << 16;
+
+    // How many bytes chunks run before runs that reached the same state are merged
+    static const std::size_t MERGE_INTERVAL = 64;
+
+    // The state after running the table from state over [begin, end)
+    int run(int state, const char* begin, const char* end) const;
+
+    // Fills ends with the state after the chunk from each state
+    void runAll(const char* begin, const char* end, std::vector<int>& ends) const;
+
+    void work();
+    void serve();
+
+    Resume<L> resume;
+
+    // Per state, a row of the next state by class of bytes. The last state is the one
+    // nothing matches from, which every byte leads back to.
+    unsigned char classes[256];
+    std::size_t width;
+    std::vector<int> table;
+    std::vector<bool> accepting;
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    std::uint64_t generation;
+    unsigned int busy;
+    bool stopping;
+
+    // The match under way: the chunks, and the state each one ends in per state it
+    // starts in (only from the first state for the first chunk)
+    const char* input;
+    std::size_t size;
+    std::size_t chunks;
+    std::atomic<std::size_t> next;
+    std::vector<std::vector<int>> ends;
+};
+
+template <typename L>
+ChunkedMatcher<L>::ChunkedMatcher(const L& language, unsigned int threads, std::size_t maxStates, std::size_t maxNodes) :
+    resume(language), width(0), generation(0), busy(0), stopping(false), input(nullptr), size(0), chunks(0), next(0)
+{
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+
+    Generator<L> generator(language, maxStates, maxNodes);
+    if (generator.resumed() == 0)
+    {
+        std::size_t dead = generator.states();
+        width = generator.byteClasses();
+        for (std::size_t b = 0; b < 256; ++b)
+        {
+            classes[b] = static_cast<unsigned char>(generator.alphabet[static_cast<char>(b)]);
+        }
+
+        table.assign((dead + 1) * width, static_cast<int>(dead));
+        for (std::size_t s = 0; s < dead; ++s)
+        {
+            for (std::size_t c = 0; c < width; ++c)
+            {
+                int target = generator.transitions[s][c];
+                if (target >= 0) table[s * width + c] = target;
+            }
+        }
+
+        accepting = generator.accepting;
+        accepting.push_back(false);
+    }
+
+    for (unsigned int t = 1; t < threads && regular(); ++t)
+    {
+        workers.emplace_back(&ChunkedMatcher<L>::serve, this);
+    }
+}
+
+template <typename L>
+ChunkedMatcher<L>::~ChunkedMatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+template <typename L>
+bool ChunkedMatcher<L>::matches(const char* data, std::size_t length)
+{
+    if (!regular()) return resume(nullptr, 0, data, length);
+
+    std::size_t count = length / MIN_CHUNK;
+    if (count > threads()) count = threads();
+    if (count <= 1) return accepting[run(0, data, data + length)];
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        input = data;
+        size = length;
+        chunks = count;
+        next = 0;
+        ends.resize(count);
+        busy = static_cast<unsigned int>(workers.size());
+        ++generation;
+    }
+    start.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return busy == 0; });
+
+    int state = ends[0][0];
+    for (std::size_t k = 1; k < chunks; ++k)
+    {
+        state = ends[k][state];
+    }
+
+    return accepting[state];
+}
+
+template <typename L>
+int ChunkedMatcher<L>::run(int state, const char* begin, const char* end) const
+{
+    const int* rows = table.data();
+    for (const char* i = begin; i != end; ++i)
+    {
+        state = rows[state * width + classes[static_cast<unsigned char>(*i)]];
+    }
+
+    return state;
+}
+
+template <typename L>
+void ChunkedMatcher<L>::runAll(const char* begin, const char* end, std::vector<int>& result) const
+{
+    // Runs are kept once per distinct state, and every start state refers to its run
+    std::size_t states = accepting.size();
+    std::vector<int> runs(states);
+    std::vector<std::size_t> of(states);
+    for (std::size_t s = 0; s < states; ++s)
+    {
+        runs[s] = static_cast<int>(s);
+        of[s] = s;
+    }
+
+    std::vector<int> merged;
+    std::vector<std::size_t> renumber;
+    std::vector<std::size_t> slot(states);
+    const int* rows = table.data();
+    const char* i = begin;
+    while (i != end && runs.size() > 1)
+    {
+        const char* stop = (static_cast<std::size_t>(end - i) > MERGE_INTERVAL) ? i + MERGE_INTERVAL : end;
+        for (; i != stop; ++i)
+        {
+            std::size_t c = classes[static_cast<unsigned char>(*i)];
+            for (int& state : runs)
+            {
+                state = rows[state * width + c];
+            }
+        }
+
+        // A slot left over from an earlier merge is only trusted if it leads back to its state
+        merged.clear();
+        renumber.resize(runs.size());
+        for (std::size_t r = 0; r < runs.size(); ++r)
+        {
+            int state = runs[r];
+            if (slot[state] >= merged.size() || merged[slot[state]] != state)
+            {
+                slot[state] = merged.size();
+                merged.push_back(state);
+            }
+            renumber[r] = slot[state];
+        }
+        for (std::size_t& r : of)
+        {
+            r = renumber[r];
+        }
+        runs.swap(merged);
+    }
+
+    // Once every run has merged into one, the rest of the chunk is a single run
+    if (runs.size() == 1) runs[0] = run(runs[0], i, end);
+
+    result.resize(states);
+    for (std::size_t s = 0; s < states; ++s)
+    {
+        result[s] = runs[of[s]];
+    }
+}
+
+// Runs chunks nobody has taken yet until there are none left
+template <typename L>
+void ChunkedMatcher<L>::work()
+{
+    for (;;)
+    {
+        std::size_t k = next.fetch_add(1, std::memory_order_relaxed);
+        if (k >= chunks) return;
+
+        const char* begin = input + size / chunks * k;
+        const char* end = (k + 1 == chunks) ? input + size : input + size / chunks * (k + 1);
+        if (k == 0)
+        {
+            ends[0].assign(1, run(0, begin, end));
+        }
+        else
+        {
+            runAll(begin, end, ends[k]);
+        }
+    }
+}
+
+template <typename L>
+void ChunkedMatcher<L>::serve()
+{
+    std::uint64_t seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+
+        work();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0) done.notify_one();
+    }
+}
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef LIB_DERP_GENERATOR_HPP
+#define LIB_DERP_GENERATOR_HPP
+
+#include "Language.hpp"
+#include "priv/Alphabet.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cassert>
+
+namespace derp
+{
+
+// Compiles a grammar ahead of time into C++ source for a table-driven matcher. The
+// derivatives of the grammar are explored breadth first by every class of bytes the
+// grammar tells apart, and each distinct derivative becomes a state of the table. A
+// derivative that grows past maxNodes nodes (as the derivatives of nested, truly
+// context-free parts of a grammar do) is left to the derivative engine, as are the
+// states past maxStates; the generated matcher hands the input over to a callback when
+// it reaches one of them. Regular grammars, and regular prefixes of any grammar, run
+// entirely from the table.
+//
+// Derivatives are told apart by their structure, so two states may still denote the
+// same language; the table is correct, if not minimal.
+template <typename L>
+class Generator
+{
+public:
+    Generator(const L& language, std::size_t maxStates = 1024, std::size_t maxNodes = 256);
+
+    // C++ source for a namespace called name holding the matcher. Its
+    // matches(input, size, resume) returns whether the input matches, calling
+    // resume(prefix, prefixSize, rest, restSize) to match the grammar against prefix
+    // followed by rest once the input leaves the table; derp::Resume does that. If no
+    // state was left to the derivative engine, matches(input, size) is generated too.
+    std::string generate(const std::string& name) const;
+
+    std::size_t states() const { return accepting.size(); }
+
+    // How many states were left to the derivative engine
+    std::size_t resumed() const;
+
+    std::size_t byteClasses() const { return alphabet.size(); }
+
+private:
+    typedef priv::Language<char> Node;
+
+    template <typename M>
+    friend class ChunkedMatcher;
+
+    priv::Alphabet alphabet;
+
+    // Per state: its row of transitions by class (-1 for no match), empty for the
+    // states left to the derivative engine, and the shortest input leading to it
+    std::vector<std::vector<int>> transitions;
+    std::vector<bool> accepting;
+    std::vector<std::string> witnesses;
+
+    // A structural key for a derivative, or an empty string if it has more than
+    // maxNodes nodes that are not the grammar's
+    static std::string key(const Node* lang, const std::unordered_map<const Node*, std::size_t>& grammar, std::size_t maxNodes);
+};
+
+template <typename L>
+Generator<L>::Generator(const L& language, std::size_t maxStates, std::size_t maxNodes) :
+    alphabet(language.l)
+{
+    typename L::GarbageCollector& gc = language.gc;
+
+    priv::Pinned<Node> pinned;
+    pinned.pin(gc);
+
+    // Grammar nodes are never changed by deriving, so keys refer to them by index
+    std::unordered_map<const Node*, std::size_t> grammar;
+    std::vector<const Node*> nodes(1, language.l);
+    grammar.emplace(language.l, 0);
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+        nodes[i]->forEachChild([&](const Node* child)
+        {
+            if (grammar.emplace(child, nodes.size()).second) nodes.push_back(child);
+        });
+    }
+
+    // The languages of the states still to be expanded
+    std::vector<Node*> languages;
+    std::unordered_map<std::string, std::size_t> index;
+
+    auto add = [&](Node* lang, std::string witness) -> int
+    {
+        std::string k = key(lang, grammar, maxNodes);
+        if (!k.empty())
+        {
+            auto found = index.find(k);
+            if (found != index.end()) return static_cast<int>(found->second);
+            index.emplace(k, accepting.size());
+        }
+
+        std::uint64_t counter = ++gc.epoch;
+        accepting.push_back(lang->isNullable(counter, gc));
+        transitions.emplace_back();
+        witnesses.push_back(std::move(witness));
+        languages.push_back(k.empty() ? nullptr : lang);
+        return static_cast<int>(accepting.size() - 1);
+    };
+
+    add(language.l, std::string());
+    for (std::size_t s = 0; s < accepting.size(); ++s)
+    {
+        // Each expansion adds at most one state per class
+        Node* lang = languages[s];
+        languages[s] = nullptr;
+        if (lang == nullptr || accepting.size() + alphabet.size() > maxStates) continue;
+
+        std::vector<int> row(alphabet.size(), -1);
+        for (std::size_t c = 0; c < alphabet.size(); ++c)
+        {
+            char token = alphabet.representative(static_cast<unsigned char>(c));
+            std::uint64_t counter = ++gc.epoch;
+            Node* derivative = lang->derive(token, counter, gc);
+            if (derivative->type != Node::NULL_LANGUAGE) row[c] = add(derivative, witnesses[s] + token);
+        }
+        transitions[s] = std::move(row);
+
+        // Now and then, drop the derivatives no state still to be expanded refers to
+        if (s % 64 == 63)
+        {
+            std::uint64_t counter = ++gc.epoch;
+            for (std::size_t p = s + 1; p < languages.size(); ++p)
+            {
+                if (languages[p] != nullptr) languages[p]->mark(counter);
+            }
+            gc.collect(priv::IsDead<char>(counter));
+        }
+    }
+
+    pinned.unpin(gc);
+}
+
+template <typename L>
+std::size_t Generator<L>::resumed() const
+{
+    std::size_t count = 0;
+    for (const std::vector<int>& row : transitions)
+    {
+        if (row.empty()) ++count;
+    }
+
+    return count;
+}
+
+template <typename L>
+std::string Generator<L>::key(const Node* lang, const std::unordered_map<const Node*, std::size_t>& grammar, std::size_t maxNodes)
+{
+    // Nodes are numbered in the order they are first reached, so equal keys mean equal
+    // structure; grammar nodes stand for themselves
+    std::string k;
+    auto append = [&](std::uint64_t value)
+    {
+        k.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+
+    std::unordered_map<const Node*, std::size_t> numbers;
+    std::vector<const Node*> pending(1, lang);
+    numbers.emplace(lang, 0);
+    for (std::size_t i = 0; i < pending.size(); ++i)
+    {
+        const Node* node = pending[i];
+        auto g = grammar.find(node);
+        if (g != grammar.end())
+        {
+            append(0);
+            append(g->second);
+            continue;
+        }
+        if (i >= maxNodes) return std::string();
+
+        append(node->type + 1);
+        switch (node->type)
+        {
+            case Node::LAZY_LANGUAGE:
+            case Node::TERMINAL_LANGUAGE:
+                append(static_cast<unsigned char>(node->t));
+                break;
+            case Node::LITERAL_LANGUAGE:
+                append(reinterpret_cast<std::uintptr_t>(node->literal.get()));
+                append(node->offset);
+                break;
+            case Node::RANGE_LANGUAGE:
+                append(reinterpret_cast<std::uintptr_t>(node->ranges.get()));
+                break;
+            case Node::EVENT_LANGUAGE:
+                append(node->event);
+                append(node->offset);
+                break;
+            case Node::CONCATENATION_LANGUAGE:
+                append(node->left != nullptr);
+                break;
+            default:
+                break;
+        }
+
+        std::size_t children = 0;
+        node->forEachChild([&](const Node*) { ++children; });
+        append(children);
+        node->forEachChild([&](const Node* child)
+        {
+            auto n = numbers.emplace(child, pending.size());
+            if (n.second) pending.push_back(child);
+            append(n.first->second);
+        });
+    }
+
+    return k;
+}
+
+template <typename L>
+std::string Generator<L>::generate(const std::string& name) const
+{
+    assert(!name.empty() && !std::isdigit(static_cast<unsigned char>(name[0])));
+
+    std::size_t states = accepting.size();
+    std::size_t classes = alphabet.size();
+    const char* cell = (states <= 127) ? "signed char" : (states <= 32767) ? "short" : "int";
+    std::size_t resumes = resumed();
+
+    std::string source;
+    char line[128];
+    auto print = [&](const char* format, std::size_t value)
+    {
+        std::snprintf(line, sizeof(line), format, value);
+        source += line;
+    };
+
+    source += "// Generated by derp::Generator\n\n";
+    source += "#include <cstddef>\n\n";
+    source += "namespace " + name + "\n{\n\n";
+
+    print("// %zu states over ", states);
+    print("%zu classes of bytes, ", classes);
+    print("%zu of them left to the derivative engine\n", resumes);
+    source += "static const unsigned char classes[256] =\n{";
+    for (std::size_t b = 0; b < 256; ++b)
+    {
+        source += (b % 16 == 0) ? "\n    " : " ";
+        print("%zu,", alphabet[static_cast<char>(b)]);
+    }
+    source += "\n};\n\n";
+
+    source += "// The state after each class of bytes, or -1 if nothing can match\n";
+    std::snprintf(line, sizeof(line), "static const %s transitions[%zu][%zu] =\n{\n", cell, states, classes);
+    source += line;
+    for (std::size_t s = 0; s < states; ++s)
+    {
+        source += "    {";
+        for (std::size_t c = 0; c < classes; ++c)
+        {
+            int target = transitions[s].empty() ? -1 : transitions[s][c];
+            std::snprintf(line, sizeof(line), (c == 0) ? "%d" : ", %d", target);
+            source += line;
+        }
+        source += "},\n";
+    }
+    source += "};\n\n";
+
+    print("static const bool accepting[%zu] =\n{", states);
+    for (std::size_t s = 0; s < states; ++s)
+    {
+        source += (s % 16 == 0) ? "\n    " : " ";
+        source += accepting[s] ? "1," : "0,";
+    }
+    source += "\n};\n\n";
+
+    source += "// For the states left to the derivative engine, an input leading to them\n";
+    print("static const char* const witnesses[%zu] =\n{\n", states);
+    for (std::size_t s = 0; s < states; ++s)
+    {
+        if (!transitions[s].empty())
+        {
+            source += "    nullptr,\n";
+            continue;
+        }
+
+        source += "    \"";
+        for (char c : witnesses[s])
+        {
+            // Octal escapes keep the literal free of trigraphs and of hex digits that
+            // would run on
+            unsigned char b = static_cast<unsigned char>(c);
+            if (std::isalnum(b) || b == ' ' || b == '_')
+            {
+                source += c;
+            }
+            else
+            {
+                std::snprintf(line, sizeof(line), "\\%03o", b);
+                source += line;
+            }
+        }
+        source += "\",\n";
+    }
+    source += "};\n\n";
+
+    print("static const std::size_t witnessSizes[%zu] =\n{", states);
+    for (std::size_t s = 0; s < states; ++s)
+    {
+        source += (s % 16 == 0) ? "\n    " : " ";
+        print("%zu,", transitions[s].empty() ? witnesses[s].size() : 0);
+    }
+    source += "\n};\n\n";
+
+    source +=
+        "template <typename R>\n"
+        "inline bool matches(const char* input, std::size_t size, R&& resume)\n"
+        "{\n"
+        "    int state = 0;\n"
+        "    for (std::size_t i = 0; i < size; ++i)\n"
+        "    {\n"
+        "        if (witnesses[state] != nullptr) return resume(witnesses[state], witnessSizes[state], input + i, size - i);\n"
+        "        state = transitions[state][classes[static_cast<unsigned char>(input[i])]];\n"
+        "        if (state < 0) return false;\n"
+        "    }\n"
+        "\n"
+        "    return accepting[state];\n"
+        "}\n";
+
+    if (resumes == 0)
+    {
+        source +=
+            "\n"
+            "inline bool matches(const char* input, std::size_t size)\n"
+            "{\n"
+            "    return matches(input, size, [](const char*, std::size_t, const char*, std::size_t) { return false; });\n"
+            "}\n";
+    }
+
+    source += "\n} // namespace " + name + "\n";
+    return source;
+}
+
+// Matches a grammar against a prefix followed by the rest of an input, for the matchers
+// Generator writes to resume with once the input leaves their tables
+template <typename L>
+class Resume
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    Resume(const L& language) : gc(language.gc), root(language.l), alphabet(language.l) {}
+
+    bool operator() (const char* prefix, std::size_t prefixSize, const char* rest, std::size_t restSize);
+
+private:
+    GarbageCollector& gc;
+    priv::Language<char>* root;
+    priv::Alphabet alphabet;
+
+    priv::Pinned<priv::Language<char>> pinned;
+};
+
+template <typename L>
+bool Resume<L>::operator() (const char* prefix, std::size_t prefixSize, const char* rest, std::size_t restSize)
+{
+    pinned.pin(gc);
+
+    std::uint64_t counter = ++gc.epoch;
+    priv::Language<char>* lang = priv::deriveAll(prefix, prefix + prefixSize, root, counter, gc, &alphabet);
+    lang = priv::deriveAll(rest, rest + restSize, lang, counter, gc, &alphabet);
+
+    bool matched = lang->isNullable(counter, gc);
+
+    pinned.unpin(gc);
+
+    return matched;
+}
+
+} // namespace derp
+
+#endif
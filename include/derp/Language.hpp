@@ -1,9 +1,13 @@
 #ifndef LIB_DERP_LANGUAGE_HPP
 #define LIB_DERP_LANGUAGE_HPP
 
+#include "priv/Alphabet.hpp"
+#include "priv/ByteSet.hpp"
 #include "priv/GarbageCollector.hpp"
 #include "priv/Language.hpp"
+#include "priv/Simd.hpp"
 
+#include <algorithm>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -18,18 +22,25 @@ class Language
 {
 public:
     typedef A GarbageCollector;
+    typedef T Token;
+    typedef std::basic_string<T> String;
 
-    Language(A& gc) : gc(gc), l(gc.allocate()) {}
-    Language(const Language<T, A>&) = default;
+    // Until it is assigned, a placeholder is the null language
+    Language(A& gc) : gc(gc), l(gc.allocate())
+    {
+        l->type = priv::Language<T>::NULL_LANGUAGE;
+        l->anonymous = false;
+    }
+    Language(const Language<T, A>& other) : gc(other.gc), l(other.l) { share(); }
     Language(Language<T, A>&&) = default;
 
     Language(A& gc, T c) : gc(gc), l(priv::terminal(gc, c)) {}
 
-    Language(A& gc, const std::string& str) : gc(gc), l(priv::sequence(gc, str)) {}
+    Language(A& gc, const String& str) : gc(gc), l(priv::sequence(gc, str)) {}
 
     Language<T, A>& operator= (const T& t) { *l = *priv::terminal(gc, t); return *this; }
 
-    Language<T, A>& operator= (const std::string& str) { *l = *priv::sequence(gc, str); return *this; }
+    Language<T, A>& operator= (const String& str) { *l = *priv::sequence(gc, str); return *this; }
 
     Language<T, A>& operator= (const Language<T, A>& other);
     Language<T, A>& operator= (Language<T, A>&& other);
@@ -48,38 +59,65 @@ private:
 
     Language(A& gc, priv::Language<T>* l) : gc(gc), l(l) {}
 
+    // Once more than a temporary refers to a node, it must no longer be extended in place
+    void share() { if (l->anonymous) l->anonymous = false; }
+
     static Language<T, A> null(A& gc) { return Language(gc, &priv::Language<T>::null); }
     static Language<T, A> empty(A& gc) { return Language(gc, &priv::Language<T>::empty); }
 
     template <typename RT, typename RA>
     friend Language<RT, RA> operator& (const Language<RT, RA>& left, const Language<RT, RA>& right);
 
-    template <typename RA>
-    friend Language<char, RA> operator& (const Language<char, RA>& left, char right);
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator& (Language<RT, RA>&& left, const Language<RT, RA>& right);
 
-    template <typename RA>
-    friend Language<char, RA> operator& (const Language<char, RA>& left, const std::string& right);
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator& (const Language<RT, RA>& left, typename Language<RT, RA>::Token right);
 
-    template <typename RA>
-    friend Language<char, RA> operator& (char left, const Language<char, RA>& right);
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator& (Language<RT, RA>&& left, typename Language<RT, RA>::Token right);
 
-    template <typename RA>
-    friend Language<char, RA> operator& (const std::string& left, const Language<char, RA>& right);
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator& (const Language<RT, RA>& left, const typename Language<RT, RA>::String& right);
+
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator& (Language<RT, RA>&& left, const typename Language<RT, RA>::String& right);
+
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator& (typename Language<RT, RA>::Token left, const Language<RT, RA>& right);
+
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator& (const typename Language<RT, RA>::String& left, const Language<RT, RA>& right);
 
     template <typename RT, typename RA>
     friend Language<RT, RA> operator| (const Language<RT, RA>& left, const Language<RT, RA>& right);
 
-    template <typename RA>
-    friend Language<char, RA> operator| (const Language<char, RA>& left, char right);
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator| (Language<RT, RA>&& left, const Language<RT, RA>& right);
 
-    template <typename RA>
-    friend Language<char, RA> operator| (const Language<char, RA>& left, const std::string& right);
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator| (const Language<RT, RA>& left, typename Language<RT, RA>::Token right);
 
-    template <typename RA>
-    friend Language<char, RA> operator| (char left, const Language<char, RA>& right);
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator| (Language<RT, RA>&& left, typename Language<RT, RA>::Token right);
 
-    template <typename RA>
-    friend Language<char, RA> operator| (const std::string& left, const Language<char, RA>& right);
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator| (const Language<RT, RA>& left, const typename Language<RT, RA>::String& right);
+
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator| (Language<RT, RA>&& left, const typename Language<RT, RA>::String& right);
+
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator| (typename Language<RT, RA>::Token left, const Language<RT, RA>& right);
+
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator| (const typename Language<RT, RA>::String& left, const Language<RT, RA>& right);
+
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator&& (const Language<RT, RA>& left, const Language<RT, RA>& right);
+
+    template <typename RT, typename RA>
+    friend Language<RT, RA> operator! (const Language<RT, RA>& pattern);
 
     template <typename RT, typename RA>
     friend Language<RT, RA> operator* (const Language<RT, RA>& pattern);
@@ -96,6 +134,48 @@ private:
     template <typename L>
     friend class Factory;
 
+    template <typename L>
+    friend class Generator;
+
+    template <typename L>
+    friend class Lexer;
+
+    template <typename L>
+    friend class Matcher;
+
+    template <typename L>
+    friend class MultiMatcher;
+
+    template <typename L, typename G>
+    friend class Pipeline;
+
+    template <typename L>
+    friend class PredictiveMatcher;
+
+    template <typename L>
+    friend class Profile;
+
+    template <typename L>
+    friend class Resume;
+
+    template <typename L>
+    friend class Sampler;
+
+    template <typename L>
+    friend class Session;
+
+    template <typename L>
+    friend class Trace;
+
+    template <typename L, typename H>
+    friend class StreamParser;
+
+    template <typename L>
+    friend class Utf8Matcher;
+
+    template <typename L, typename S>
+    friend class Weigher;
+
     friend struct std::hash<Language<T, A>>;
 };
 
@@ -113,9 +193,17 @@ Language<T, A>& Language<T, A>::operator= (const Language<T, A>& other)
         case priv::Language<T>::ALTERNATE_LANGUAGE:  assert(other.l->left); assert(other.l->right); break;
         case priv::Language<T>::SEQUENCE_LANGUAGE:   assert(other.l->left); assert(other.l->right); break;
         case priv::Language<T>::REPETITION_LANGUAGE: assert(other.l->pattern); break;
+        case priv::Language<T>::UNION_LANGUAGE:      assert(other.l->children.size() > 1); break;
+        case priv::Language<T>::CONCATENATION_LANGUAGE: assert(other.l->spine); break;
+        case priv::Language<T>::LITERAL_LANGUAGE:    assert(other.l->literal); break;
+        case priv::Language<T>::EVENT_LANGUAGE:      break;
+        case priv::Language<T>::RANGE_LANGUAGE:      assert(other.l->ranges); break;
+        case priv::Language<T>::INTERSECTION_LANGUAGE: assert(other.l->left); assert(other.l->right); break;
+        case priv::Language<T>::COMPLEMENT_LANGUAGE: assert(other.l->pattern); break;
     }
 
     *l = *other.l;
+    l->anonymous = false;
     return *this;
 }
 
@@ -133,9 +221,19 @@ Language<T, A>& Language<T, A>::operator= (Language<T, A>&& other)
         case priv::Language<T>::ALTERNATE_LANGUAGE:  assert(other.l->left); assert(other.l->right); break;
         case priv::Language<T>::SEQUENCE_LANGUAGE:   assert(other.l->left); assert(other.l->right); break;
         case priv::Language<T>::REPETITION_LANGUAGE: assert(other.l->pattern); break;
+        case priv::Language<T>::UNION_LANGUAGE:      assert(other.l->children.size() > 1); break;
+        case priv::Language<T>::CONCATENATION_LANGUAGE: assert(other.l->spine); break;
+        case priv::Language<T>::LITERAL_LANGUAGE:    assert(other.l->literal); break;
+        case priv::Language<T>::EVENT_LANGUAGE:      break;
+        case priv::Language<T>::RANGE_LANGUAGE:      assert(other.l->ranges); break;
+        case priv::Language<T>::INTERSECTION_LANGUAGE: assert(other.l->left); assert(other.l->right); break;
+        case priv::Language<T>::COMPLEMENT_LANGUAGE: assert(other.l->pattern); break;
     }
 
-    *l = std::move(*other.l);
+    // Other handles (and other nodes) may still refer to the node, so it is copied
+    // rather than moved from
+    *l = *other.l;
+    l->anonymous = false;
     return *this;
 }
 
@@ -158,36 +256,20 @@ bool Language<T, A>::operator<(const Language<T, A>& other) const
 template <typename T, typename A>
 std::string Language<T, A>::toString() const
 {
-    std::vector<priv::Language<T>*> v;
-    gc.steal(v);
-    for (priv::Language<T>* lang : v)
-    {
-        lang->marker = 1;
-    }
-    gc.give(v);
-
-    return l->toString(0);
+    return l->toString(++gc.epoch);
 }
 
 template <typename T, typename A>
 template <typename C>
 std::string Language<T, A>::toString(const C& c) const
 {
-    std::vector<priv::Language<T>*> v;
-    gc.steal(v);
-    for (priv::Language<T>* lang : v)
-    {
-        lang->marker = 1;
-    }
-    gc.give(v);
-
     std::unordered_map<const priv::Language<T>*, const std::string&> cp;
     for (const auto& i : c)
     {
         cp.emplace(i.first.l, i.second);
     }
 
-    return l->toString(0, cp, true);
+    return l->toString(++gc.epoch, cp, true);
 }
 
 // Sequence
@@ -198,28 +280,48 @@ Language<T, A> operator& (const Language<T, A>& left, const Language<T, A>& righ
     return Language<T, A>(left.gc, priv::sequence(left.gc, left.l, right.l));
 }
 
-template <typename A>
-Language<char, A> operator& (const Language<char, A>& left, char right)
+template <typename T, typename A>
+Language<T, A> operator& (const Language<T, A>& left, typename Language<T, A>::Token right)
 {
-    return Language<char, A>(left.gc, priv::sequence(left.gc, left.l, priv::terminal(left.gc, right)));
+    return Language<T, A>(left.gc, priv::sequence(left.gc, left.l, priv::terminal(left.gc, right)));
 }
 
-template <typename A>
-Language<char, A> operator& (const Language<char, A>& left, const std::string& right)
+template <typename T, typename A>
+Language<T, A> operator& (const Language<T, A>& left, const typename Language<T, A>::String& right)
 {
-    return Language<char, A>(left.gc, priv::sequence(left.gc, left.l, priv::sequence(left.gc, right)));
+    return Language<T, A>(left.gc, priv::sequence(left.gc, left.l, priv::sequence(left.gc, right)));
 }
 
-template <typename A>
-Language<char, A> operator& (char left, const Language<char, A>& right)
+// Sequence, extending a temporary left operand in place
+template <typename T, typename A>
+Language<T, A> operator& (Language<T, A>&& left, const Language<T, A>& right)
 {
-    return Language<char, A>(right.gc, priv::sequence(right.gc, priv::terminal(right.gc, left), right.l));
+    assert(&left.gc == &right.gc);
+    return Language<T, A>(left.gc, priv::concatenate(left.gc, left.l, right.l));
 }
 
-template <typename A>
-Language<char, A> operator& (const std::string& left, const Language<char, A>& right)
+template <typename T, typename A>
+Language<T, A> operator& (Language<T, A>&& left, typename Language<T, A>::Token right)
+{
+    return Language<T, A>(left.gc, priv::concatenate(left.gc, left.l, priv::terminal(left.gc, right)));
+}
+
+template <typename T, typename A>
+Language<T, A> operator& (Language<T, A>&& left, const typename Language<T, A>::String& right)
+{
+    return Language<T, A>(left.gc, priv::concatenate(left.gc, left.l, priv::sequence(left.gc, right)));
+}
+
+template <typename T, typename A>
+Language<T, A> operator& (typename Language<T, A>::Token left, const Language<T, A>& right)
 {
-    return Language<char, A>(right.gc, priv::sequence(right.gc, priv::sequence(right.gc, left), right.l));
+    return Language<T, A>(right.gc, priv::sequence(right.gc, priv::terminal(right.gc, left), right.l));
+}
+
+template <typename T, typename A>
+Language<T, A> operator& (const typename Language<T, A>::String& left, const Language<T, A>& right)
+{
+    return Language<T, A>(right.gc, priv::sequence(right.gc, priv::sequence(right.gc, left), right.l));
 }
 
 // Alternate
@@ -230,28 +332,66 @@ Language<T, A> operator| (const Language<T, A>& left, const Language<T, A>& righ
     return Language<T, A>(left.gc, priv::alternate(left.gc, left.l, right.l));
 }
 
-template <typename A>
-Language<char, A> operator| (const Language<char, A>& left, char right)
+template <typename T, typename A>
+Language<T, A> operator| (const Language<T, A>& left, typename Language<T, A>::Token right)
 {
-    return Language<char, A>(left.gc, priv::alternate(left.gc, left.l, priv::terminal(left.gc, right)));
+    return Language<T, A>(left.gc, priv::alternate(left.gc, left.l, priv::terminal(left.gc, right)));
 }
 
-template <typename A>
-Language<char, A> operator| (const Language<char, A>& left, const std::string& right)
+template <typename T, typename A>
+Language<T, A> operator| (const Language<T, A>& left, const typename Language<T, A>::String& right)
 {
-    return Language<char, A>(left.gc, priv::alternate(left.gc, left.l, priv::sequence(left.gc, right)));
+    return Language<T, A>(left.gc, priv::alternate(left.gc, left.l, priv::sequence(left.gc, right)));
 }
 
-template <typename A>
-Language<char, A> operator| (char left, const Language<char, A>& right)
+// Alternate, extending a temporary left operand in place
+template <typename T, typename A>
+Language<T, A> operator| (Language<T, A>&& left, const Language<T, A>& right)
 {
-    return Language<char, A>(right.gc, priv::alternate(right.gc, priv::terminal(right.gc, left), right.l));
+    assert(&left.gc == &right.gc);
+    return Language<T, A>(left.gc, priv::unite(left.gc, left.l, right.l));
 }
 
-template <typename A>
-Language<char, A> operator| (const std::string& left, const Language<char, A>& right)
+template <typename T, typename A>
+Language<T, A> operator| (Language<T, A>&& left, typename Language<T, A>::Token right)
+{
+    return Language<T, A>(left.gc, priv::unite(left.gc, left.l, priv::terminal(left.gc, right)));
+}
+
+template <typename T, typename A>
+Language<T, A> operator| (Language<T, A>&& left, const typename Language<T, A>::String& right)
+{
+    return Language<T, A>(left.gc, priv::unite(left.gc, left.l, priv::sequence(left.gc, right)));
+}
+
+template <typename T, typename A>
+Language<T, A> operator| (typename Language<T, A>::Token left, const Language<T, A>& right)
+{
+    return Language<T, A>(right.gc, priv::alternate(right.gc, priv::terminal(right.gc, left), right.l));
+}
+
+template <typename T, typename A>
+Language<T, A> operator| (const typename Language<T, A>::String& left, const Language<T, A>& right)
+{
+    return Language<T, A>(right.gc, priv::alternate(right.gc, priv::sequence(right.gc, left), right.l));
+}
+
+// Intersection: what both languages match. Either side may be context-free; the
+// intersection of two context-free languages is not always context-free, but deriving
+// still decides it. Events and parses come from the left side.
+template <typename T, typename A>
+Language<T, A> operator&& (const Language<T, A>& left, const Language<T, A>& right)
+{
+    assert(&left.gc == &right.gc);
+    return Language<T, A>(left.gc, priv::intersection(left.gc, left.l, right.l));
+}
+
+// Complement: every string the language does not match. The language must not refer
+// back to the complement, as a language defined by its own complement has no meaning.
+template <typename T, typename A>
+Language<T, A> operator! (const Language<T, A>& pattern)
 {
-    return Language<char, A>(right.gc, priv::alternate(right.gc, priv::sequence(right.gc, left), right.l));
+    return Language<T, A>(pattern.gc, priv::complement(pattern.gc, pattern.l));
 }
 
 // Kleene star
@@ -302,41 +442,120 @@ public:
         return L::empty(gc);
     }
 
+    // Any token from first to last, inclusive
+    L range(typename L::Token first, typename L::Token last) const
+    {
+        return L(gc, priv::range(gc, std::vector<std::pair<typename L::Token, typename L::Token>>(1, std::make_pair(first, last))));
+    }
+
+    // Any token in one of the inclusive ranges, like a character class
+    L ranges(const std::vector<std::pair<typename L::Token, typename L::Token>>& r) const
+    {
+        return L(gc, priv::range(gc, r));
+    }
+
+    // Any token in none of the inclusive ranges, like a negated character class
+    L except(const std::vector<std::pair<typename L::Token, typename L::Token>>& r) const
+    {
+        return L(gc, priv::except(gc, r));
+    }
+
 private:
     typename L::GarbageCollector& gc;
 };
 
-template <typename A>
-bool matches(const std::string& input, Language<char, A>& language)
+namespace priv
 {
-    A& gc = language.gc;
-    priv::Language<char>* lang = language.l;
 
-    std::vector<priv::Language<char>*> invincible;
-    gc.steal(invincible);
+// Derives lang by every token of [i, end), leaving the last counter used in counter.
+// Given the grammar's alphabet, a byte found to loop lets its whole class loop.
+template <typename A>
+Language<char>* deriveAll(const char* i, const char* end, Language<char>* lang, std::uint64_t& counter, A& gc, const Alphabet* alphabet = nullptr)
+{
+    // Bytes whose derivative of the current language is the language itself; runs of
+    // them (whitespace, string bodies) are skipped without deriving
+    ByteSet loop;
 
-    unsigned int counter = 0;
-    for (priv::Language<char>* l : invincible)
+    while (i != end)
     {
-        l->marker = counter;
-        l->memoize = nullptr;
+        if (loop.contains(*i))
+        {
+            i = loop.skip(i, end);
+            continue;
+        }
+
+        // While a literal must be matched next, compare it against the input in bulk,
+        // leaving its last token to derive() so the derivative gets compacted
+        Language<char>* literal = lang->leadingLiteral();
+        if (literal != nullptr)
+        {
+            std::size_t remaining = literal->literal->size() - literal->offset - 1;
+            std::size_t available = static_cast<std::size_t>(end - i);
+            std::size_t count = commonPrefix(literal->literal->data() + literal->offset, i, std::min(remaining, available));
+            if (count > 1)
+            {
+                counter = ++gc.epoch;
+                lang = lang->advanceLiteral(count, counter, gc);
+                gc.collect(IsDead<char>(counter));
+                loop.clear();
+                i += count;
+                continue;
+            }
+        }
+
+        counter = ++gc.epoch;
+        Language<char>* derivative = lang->derive(*i, counter, gc);
+
+        unsigned int budget = 64;
+        if (derivative->equivalent(lang, budget))
+        {
+            if (alphabet != nullptr)
+            {
+                alphabet->insertClass(loop, *i);
+            }
+            else
+            {
+                loop.insert(*i);
+            }
+        }
+        else if (!loop.empty())
+        {
+            loop.clear();
+        }
+
+        lang = derivative;
+        gc.collect(IsDead<char>(counter));
+        ++i;
     }
 
-    for (char c : input)
-    {
-        ++counter;
-        lang = lang->derive(c, counter, gc);
-        gc.collect(priv::IsDead<char>(counter));
-    }
+    return lang;
+}
+
+// Matches [i, end) against a grammar node, pinning the grammar for the duration
+template <typename A>
+bool matches(const char* i, const char* end, Language<char>* lang, A& gc, Pinned<Language<char>>& pinned, const Alphabet* alphabet = nullptr)
+{
+    pinned.pin(gc);
+
+    std::uint64_t counter = ++gc.epoch;
+    lang = deriveAll(i, end, lang, counter, gc, alphabet);
 
     bool matched = lang->isNullable(counter, gc);
 
-    gc.collect();
-    gc.give(invincible);
+    pinned.unpin(gc);
 
     return matched;
 }
 
+} // namespace priv
+
+template <typename A>
+bool matches(const std::string& input, Language<char, A>& language)
+{
+    priv::Pinned<priv::Language<char>> pinned;
+    return priv::matches(input.data(), input.data() + input.size(), language.l, language.gc, pinned);
+}
+
 } // namespace derp
 
 namespace std
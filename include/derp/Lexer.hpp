@@ -0,0 +1,154 @@
+#ifndef LIB_DERP_LEXER_HPP
+#define LIB_DERP_LEXER_HPP
+
+#include "Language.hpp"
+
+#include <string>
+#include <vector>
+
+#include <cassert>
+
+namespace derp
+{
+
+// A token the lexer found: which definition it matched, and where
+struct Token
+{
+    std::size_t id;
+    std::size_t offset;
+    std::size_t size;
+};
+
+// Splits input into tokens defined by languages, as a lexer generator would. From each
+// position, every definition is derived at once (with a shared counter, as MultiMatcher
+// does) until all of them derive to null; the longest prefix some definition matches
+// is the next token, and among definitions matching the same prefix, the first one
+// wins. Token ids are indices into the definitions. Tokens never match the empty input.
+template <typename L>
+class Lexer
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    // Definitions in order of priority. Tokens of an ignored definition (such as
+    // whitespace) are matched but not emitted.
+    explicit Lexer(const std::vector<L>& definitions, const std::vector<std::size_t>& ignored = std::vector<std::size_t>());
+
+    // Calls emit(token) with each token in turn, until it returns false. Returns false
+    // if emit did, or if no definition matches at some position, which error() gives.
+    template <typename F>
+    bool tokenize(const char* input, std::size_t size, F emit);
+
+    template <typename F>
+    bool tokenize(const std::string& input, F emit)
+    {
+        return tokenize(input.data(), input.size(), emit);
+    }
+
+    // The offset no token matched from in the last input, or npos if it was tokenized
+    std::size_t error() const { return invalid; }
+
+    std::size_t size() const { return roots.size(); }
+
+private:
+    typedef priv::Language<char> Node;
+
+    GarbageCollector& gc;
+    std::vector<Node*> roots;
+    std::vector<bool> emitted;
+    std::size_t invalid;
+
+    // Pairs of definition and its derivative, in order of priority
+    std::vector<std::pair<std::size_t, Node*>> live;
+
+    priv::Pinned<Node> pinned;
+};
+
+template <typename L>
+Lexer<L>::Lexer(const std::vector<L>& definitions, const std::vector<std::size_t>& ignored) :
+    gc(definitions.front().gc), emitted(definitions.size(), true), invalid(std::string::npos)
+{
+    for (const L& definition : definitions)
+    {
+        assert(&gc == &definition.gc);
+        roots.push_back(definition.l);
+    }
+
+    for (std::size_t id : ignored)
+    {
+        assert(id < emitted.size());
+        emitted[id] = false;
+    }
+}
+
+template <typename L>
+template <typename F>
+bool Lexer<L>::tokenize(const char* input, std::size_t size, F emit)
+{
+    pinned.pin(gc);
+
+    std::uint64_t counter = ++gc.epoch;
+    bool tokenized = true;
+    invalid = std::string::npos;
+
+    std::size_t start = 0;
+    while (start != size)
+    {
+        live.clear();
+        for (std::size_t id = 0; id < roots.size(); ++id)
+        {
+            live.emplace_back(id, roots[id]);
+        }
+
+        // The longest token so far
+        Token token = {0, start, 0};
+        for (std::size_t i = start; i != size && !live.empty(); ++i)
+        {
+            counter = ++gc.epoch;
+
+            // Definitions that derive to null can never match again; the rest keep
+            // their order, so the first nullable one has the highest priority
+            std::size_t kept = 0;
+            bool found = false;
+            for (std::pair<std::size_t, Node*>& l : live)
+            {
+                l.second = l.second->derive(input[i], counter, gc);
+                if (l.second->type == Node::NULL_LANGUAGE) continue;
+
+                if (!found && l.second->isNullable(counter, gc))
+                {
+                    token.id = l.first;
+                    token.size = i + 1 - start;
+                    found = true;
+                }
+                live[kept++] = l;
+            }
+            live.resize(kept);
+
+            gc.collect(priv::IsDead<char>(counter));
+        }
+
+        if (token.size == 0)
+        {
+            invalid = start;
+            tokenized = false;
+            break;
+        }
+
+        start += token.size;
+        if (emitted[token.id] && !emit(token))
+        {
+            tokenized = false;
+            break;
+        }
+    }
+
+    live.clear();
+    pinned.unpin(gc);
+
+    return tokenized;
+}
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef LIB_DERP_MATCHER_HPP
+#define LIB_DERP_MATCHER_HPP
+
+#include "Language.hpp"
+#include "priv/PrefixCache.hpp"
+
+#include <string>
+#include <vector>
+
+namespace derp
+{
+
+// Matches many inputs against one language. Grammar nodes are never reset between
+// inputs (the collector's epoch makes their memos stale instead) and the matcher's
+// buffers are reused, so starting a match costs the same however large the grammar
+// is. Suited to many short inputs, such as the fields of a record.
+//
+// Given a cache capacity (in nodes), the derivatives by the first cacheDepth tokens of
+// each input are kept, and inputs resume from their longest cached prefix. Bytes the
+// grammar cannot tell apart (such as the letters of an identifier) share cache entries.
+// The grammar must not change while the matcher is in use.
+template <typename L>
+class Matcher
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    Matcher(const L& language, std::size_t cacheCapacity = 0, std::size_t cacheDepth = 64) :
+        gc(language.gc), root(language.l), alphabet(language.l), cache(language.gc, language.l, alphabet, cacheCapacity, cacheDepth)
+    {
+    }
+
+    bool matches(const char* input, std::size_t size);
+
+    bool matches(const std::string& input)
+    {
+        return matches(input.data(), input.size());
+    }
+
+    // Returns whether each input of a range matches, in order
+    template <typename R>
+    std::vector<bool> matchAll(const R& inputs);
+
+    const PrefixCacheStats& cacheStats() const { return cache.stats(); }
+
+    // How many classes of bytes the grammar tells apart
+    std::size_t byteClasses() const { return alphabet.size(); }
+
+private:
+    GarbageCollector& gc;
+    priv::Language<char>* root;
+    priv::Alphabet alphabet;
+
+    priv::Pinned<priv::Language<char>> pinned;
+
+    priv::PrefixCache<GarbageCollector> cache;
+};
+
+template <typename L>
+bool Matcher<L>::matches(const char* input, std::size_t size)
+{
+    const char* i = input;
+    const char* end = input + size;
+    if (!cache.enabled()) return priv::matches(i, end, root, gc, pinned, &alphabet);
+
+    pinned.pin(gc);
+
+    std::uint64_t counter = ++gc.epoch;
+
+    std::size_t entry;
+    priv::Language<char>* lang = cache.resume(i, end, entry);
+    // Cache the derivative by every token up to the cache's depth, but stop at the first
+    // null one, as every longer prefix derives to null as well
+    for (; i != end && cache.extends(entry) && lang->type != priv::Language<char>::NULL_LANGUAGE; ++i)
+    {
+        counter = ++gc.epoch;
+        lang = lang->derive(*i, counter, gc);
+        gc.collect(priv::IsDead<char>(counter));
+        entry = cache.insert(entry, *i, lang, counter);
+    }
+
+    lang = priv::deriveAll(i, end, lang, counter, gc, &alphabet);
+
+    bool matched = lang->isNullable(counter, gc);
+
+    cache.finish(entry);
+    pinned.unpin(gc);
+
+    return matched;
+}
+
+template <typename L>
+template <typename R>
+std::vector<bool> Matcher<L>::matchAll(const R& inputs)
+{
+    std::vector<bool> results;
+    for (const auto& input : inputs)
+    {
+        results.push_back(matches(input));
+    }
+
+    return results;
+}
+
+} // namespace derp
+
+#endif
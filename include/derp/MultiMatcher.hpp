@@ -0,0 +1,102 @@
+#ifndef LIB_DERP_MULTI_MATCHER_HPP
+#define LIB_DERP_MULTI_MATCHER_HPP
+
+#include "Language.hpp"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+
+namespace derp
+{
+
+// Matches one input against several languages in a single pass. All roots are
+// derived with the same counter, so derivatives of subgraphs they share (built
+// in the same garbage collector) are memoized once per token and reused.
+template <typename L>
+class MultiMatcher
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    MultiMatcher(GarbageCollector& gc) : gc(gc) {}
+
+    void insert(const L& language)
+    {
+        assert(&gc == &language.gc);
+        roots.push_back(language.l);
+    }
+
+    std::size_t size() const { return roots.size(); }
+    bool empty() const { return roots.empty(); }
+
+    // Returns the languages that match the input, in insertion order
+    std::vector<L> matches(const std::string& input);
+
+private:
+    GarbageCollector& gc;
+    std::vector<priv::Language<char>*> roots;
+};
+
+template <typename L>
+std::vector<L> MultiMatcher<L>::matches(const std::string& input)
+{
+    priv::Pinned<priv::Language<char>> pinned;
+    pinned.pin(gc);
+
+    std::uint64_t counter = ++gc.epoch;
+
+    // Pairs of (root index, current derivative)
+    std::vector<std::pair<std::size_t, priv::Language<char>*>> live;
+    live.reserve(roots.size());
+    for (std::size_t i = 0; i < roots.size(); ++i)
+    {
+        live.emplace_back(i, roots[i]);
+    }
+
+    for (char c : input)
+    {
+        if (live.empty()) break;
+
+        counter = ++gc.epoch;
+        for (std::size_t i = 0; i < live.size();)
+        {
+            live[i].second = live[i].second->derive(c, counter, gc);
+
+            // Roots that derive to the null language can never match again
+            if (live[i].second->type == priv::Language<char>::NULL_LANGUAGE)
+            {
+                live[i] = live.back();
+                live.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+
+        gc.collect(priv::IsDead<char>(counter));
+    }
+
+    std::vector<bool> accepted(roots.size(), false);
+    for (const std::pair<std::size_t, priv::Language<char>*>& l : live)
+    {
+        accepted[l.first] = l.second->isNullable(counter, gc);
+    }
+
+    pinned.unpin(gc);
+
+    std::vector<L> result;
+    for (std::size_t i = 0; i < roots.size(); ++i)
+    {
+        if (accepted[i]) result.push_back(L(gc, roots[i]));
+    }
+
+    return result;
+}
+
+} // namespace derp
+
+#endif
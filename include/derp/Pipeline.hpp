@@ -0,0 +1,142 @@
+#ifndef LIB_DERP_PIPELINE_HPP
+#define LIB_DERP_PIPELINE_HPP
+
+#include "Language.hpp"
+#include "Lexer.hpp"
+#include "priv/RingBuffer.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace derp
+{
+
+// Matches input in two stages: a Lexer turns bytes into tokens, and a grammar over
+// token ids (such as a Language<unsigned int>) is derived by each of them. Lexical
+// rules then never enter the grammar's derivatives, which stay as small as the
+// structure of the input.
+//
+// Given threaded, the lexer runs on a thread of its own and hands tokens over through
+// a lock-free ring buffer, while the grammar is derived on the calling thread. Either
+// stage stops the other early: the lexer at input no token matches, and the grammar
+// once it derives to null. The grammar must not share a collector with the lexer's
+// definitions, as the two are then derived at the same time.
+template <typename L, typename G>
+class Pipeline
+{
+public:
+    typedef typename G::GarbageCollector GarbageCollector;
+
+    // capacity is the number of tokens the ring buffer holds
+    Pipeline(Lexer<L>& lexer, const G& grammar, std::size_t capacity = 4096) :
+        lexer(lexer), gc(grammar.gc), root(grammar.l), capacity(capacity)
+    {
+    }
+
+    bool matches(const char* input, std::size_t size, bool threaded = false);
+
+    bool matches(const std::string& input, bool threaded = false)
+    {
+        return matches(input.data(), input.size(), threaded);
+    }
+
+    // The offset no token matched from in the last input, or npos
+    std::size_t error() const { return lexer.error(); }
+
+private:
+    typedef priv::Language<typename G::Token> Node;
+
+    // The parser's state while deriving the grammar by tokens
+    struct Parse
+    {
+        Node* lang;
+        std::uint64_t counter;
+    };
+
+    bool derive(Parse& parse, const Token& token);
+
+    Lexer<L>& lexer;
+    GarbageCollector& gc;
+    Node* root;
+    std::size_t capacity;
+
+    priv::Pinned<Node> pinned;
+};
+
+// Derives the grammar by a token, returning false once it can no longer match
+template <typename L, typename G>
+bool Pipeline<L, G>::derive(Parse& parse, const Token& token)
+{
+    parse.counter = ++gc.epoch;
+    parse.lang = parse.lang->derive(static_cast<typename G::Token>(token.id), parse.counter, gc);
+    gc.collect(priv::IsDead<typename G::Token>(parse.counter));
+    return parse.lang->type != Node::NULL_LANGUAGE;
+}
+
+template <typename L, typename G>
+bool Pipeline<L, G>::matches(const char* input, std::size_t size, bool threaded)
+{
+    pinned.pin(gc);
+
+    Parse parse = {root, ++gc.epoch};
+    bool tokenized;
+    if (!threaded)
+    {
+        tokenized = lexer.tokenize(input, size, [&](const Token& token) { return derive(parse, token); });
+    }
+    else
+    {
+        priv::RingBuffer<Token> tokens(capacity);
+        std::atomic<bool> done(false);
+        std::atomic<bool> cancelled(false);
+
+        std::thread producer([&]
+        {
+            tokenized = lexer.tokenize(input, size, [&](const Token& token)
+            {
+                if (cancelled.load(std::memory_order_relaxed)) return false;
+                while (!tokens.push(token))
+                {
+                    if (cancelled.load(std::memory_order_relaxed)) return false;
+                    std::this_thread::yield();
+                }
+                return true;
+            });
+            done.store(true, std::memory_order_release);
+        });
+
+        // Tokens pushed before done was set are all in the buffer once it is seen
+        Token token;
+        for (;;)
+        {
+            if (tokens.pop(token))
+            {
+                if (!derive(parse, token)) break;
+            }
+            else if (done.load(std::memory_order_acquire))
+            {
+                if (!tokens.pop(token)) break;
+                if (!derive(parse, token)) break;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        cancelled.store(true, std::memory_order_relaxed);
+        producer.join();
+    }
+
+    bool matched = tokenized && parse.lang->isNullable(parse.counter, gc);
+
+    pinned.unpin(gc);
+
+    return matched;
+}
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,557 @@
+#ifndef LIB_DERP_PREDICTIVE_MATCHER_HPP
+#define LIB_DERP_PREDICTIVE_MATCHER_HPP
+
+#include "Language.hpp"
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace derp
+{
+
+struct PredictiveStats
+{
+    std::size_t predicted = 0; // Tokens matched by the stack machine
+    std::size_t derived = 0;   // Tokens matched by deriving
+    std::size_t fallbacks = 0; // Times the stack machine handed over to derivatives
+    std::size_t resumes = 0;   // Times derivatives handed back to the stack machine
+};
+
+// Matches inputs against a language like Matcher, but matches the deterministic parts
+// of the grammar with a stack of grammar nodes still to match, as an LL(1) parser
+// would, allocating nothing. Where the next token does not decide which way to go
+// (alternatives that both start with it, or one that starts with it where a nullable
+// one could be skipped over to something that does), the stack turns into the
+// language it stands for and matching goes on by deriving. Once a derivative is a
+// sequence of grammar nodes again, the stack machine takes over once more.
+//
+// Choices are made by the FIRST sets of the alternatives and of the stack below them,
+// which is exact, so nothing about where a language is used needs to be known and the
+// result is always that of deriving. The grammar must not change while the matcher is
+// in use.
+template <typename L>
+class PredictiveMatcher
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    explicit PredictiveMatcher(const L& language);
+
+    PredictiveMatcher(const PredictiveMatcher<L>&) = delete;
+    PredictiveMatcher<L>& operator= (const PredictiveMatcher<L>&) = delete;
+
+    bool matches(const char* input, std::size_t size);
+
+    bool matches(const std::string& input)
+    {
+        return matches(input.data(), input.size());
+    }
+
+    // Counted over every match so far
+    const PredictiveStats& stats() const { return counts; }
+
+private:
+    typedef priv::Language<char> Node;
+
+    struct Rule
+    {
+        enum Kind
+        {
+            FAIL,     // Matches nothing
+            SKIP,     // Matches the empty string only
+            TERMINAL,
+            LITERAL,
+            SEQUENCE,
+            CHOICE,
+            REPEAT,
+            OPAQUE    // Not yet defined, or a filter, so only derivatives can tell
+        };
+
+        Node* node;
+        Kind kind;
+
+        // The bytes that can start a word, and whether the empty word is one
+        std::bitset<256> first;
+        bool nullable;
+
+        // In order; a repetition's pattern is its only child
+        std::vector<Rule*> children;
+
+        // For CHOICE: the only child whose FIRST set has a byte, or -1 if several do; and
+        // per child, whether another child is nullable
+        std::vector<std::int16_t> pick;
+        std::vector<bool> nullableOther;
+    };
+
+    struct Entry
+    {
+        const Rule* rule;
+
+        // For LITERAL: the next token to match
+        std::size_t offset;
+    };
+
+    static Entry entry(const Rule* r)
+    {
+        return Entry{r, (r->kind == Rule::LITERAL) ? r->node->offset : 0};
+    }
+
+    enum Step
+    {
+        CONSUMED,
+        FAILED,
+        FALLBACK
+    };
+
+    Rule* rule(Node* node);
+    Step predict(char c);
+    bool follows(char c, std::size_t below) const;
+    Node* language(std::uint64_t counter);
+    bool resume(Node* lang);
+    bool items(Node* lang, std::vector<Entry>& order);
+
+    GarbageCollector& gc;
+    std::vector<std::unique_ptr<Rule>> rules;
+    std::unordered_map<const Node*, Rule*> index;
+    std::unordered_map<const std::string*, Rule*> literals;
+    Rule* root;
+
+    priv::Pinned<Node> pinned;
+
+    // Top last
+    std::vector<Entry> stack;
+    std::vector<Entry> order;
+    std::unordered_set<const Node*> visited;
+
+    PredictiveStats counts;
+};
+
+template <typename L>
+PredictiveMatcher<L>::PredictiveMatcher(const L& language) :
+    gc(language.gc)
+{
+    root = rule(language.l);
+
+    // FIRST sets and nullability are least fixed points
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (std::size_t i = rules.size(); i-- > 0;)
+        {
+            Rule& r = *rules[i];
+
+            std::bitset<256> first = r.first;
+            bool nullable = r.nullable;
+            switch (r.kind)
+            {
+                case Rule::FAIL:
+                case Rule::SKIP:
+                case Rule::TERMINAL:
+                case Rule::LITERAL:
+                case Rule::OPAQUE:
+                    break;
+                case Rule::SEQUENCE:
+                    nullable = true;
+                    for (const Rule* child : r.children)
+                    {
+                        first |= child->first;
+                        if (!child->nullable)
+                        {
+                            nullable = false;
+                            break;
+                        }
+                    }
+                    break;
+                case Rule::CHOICE:
+                    for (const Rule* child : r.children)
+                    {
+                        first |= child->first;
+                        nullable = nullable || child->nullable;
+                    }
+                    break;
+                case Rule::REPEAT:
+                    first |= r.children[0]->first;
+                    break;
+            }
+
+            if (first != r.first || nullable != r.nullable)
+            {
+                r.first = first;
+                r.nullable = nullable;
+                changed = true;
+            }
+        }
+    }
+
+    for (const std::unique_ptr<Rule>& r : rules)
+    {
+        if (r->kind != Rule::CHOICE) continue;
+
+        r->pick.assign(256, -1);
+        r->nullableOther.assign(r->children.size(), false);
+        for (std::size_t b = 0; b < 256; ++b)
+        {
+            std::size_t count = 0;
+            for (std::size_t i = 0; i < r->children.size(); ++i)
+            {
+                if (r->children[i]->first[b])
+                {
+                    r->pick[b] = static_cast<std::int16_t>(i);
+                    ++count;
+                }
+            }
+            if (count > 1) r->pick[b] = -1;
+        }
+
+        std::size_t nullables = 0;
+        for (const Rule* child : r->children)
+        {
+            if (child->nullable) ++nullables;
+        }
+        for (std::size_t i = 0; i < r->children.size(); ++i)
+        {
+            r->nullableOther[i] = nullables > (r->children[i]->nullable ? 1 : 0);
+        }
+    }
+}
+
+// The rule of a grammar node, made along with those of its children
+template <typename L>
+typename PredictiveMatcher<L>::Rule* PredictiveMatcher<L>::rule(Node* node)
+{
+    auto found = index.find(node);
+    if (found != index.end()) return found->second;
+
+    rules.emplace_back(new Rule);
+    Rule* r = rules.back().get();
+    index.emplace(node, r);
+
+    r->node = node;
+    r->nullable = false;
+    switch (node->type)
+    {
+        case Node::NULL_LANGUAGE:
+            r->kind = Rule::FAIL;
+            break;
+        case Node::EMPTY_LANGUAGE:
+        case Node::EVENT_LANGUAGE:
+            r->kind = Rule::SKIP;
+            r->nullable = true;
+            break;
+        case Node::TERMINAL_LANGUAGE:
+            r->kind = Rule::TERMINAL;
+            r->first.set(static_cast<unsigned char>(node->t));
+            break;
+        case Node::RANGE_LANGUAGE:
+            r->kind = Rule::TERMINAL;
+            for (std::size_t b = 0; b < 256; ++b)
+            {
+                if (node->inRanges(static_cast<char>(b))) r->first.set(b);
+            }
+            break;
+        case Node::LITERAL_LANGUAGE:
+            r->kind = Rule::LITERAL;
+            r->first.set(static_cast<unsigned char>((*node->literal)[node->offset]));
+            literals.emplace(node->literal.get(), r);
+            break;
+        case Node::LAZY_LANGUAGE:
+            // Anything could follow, so no choice is ever made around it
+            r->kind = Rule::OPAQUE;
+            r->first.set();
+            r->nullable = true;
+            break;
+        case Node::INTERSECTION_LANGUAGE:
+        case Node::COMPLEMENT_LANGUAGE:
+            // Filters are left to derivatives too, though what they match when the
+            // input ends is known
+            r->kind = Rule::OPAQUE;
+            r->first.set();
+            r->nullable = node->isNullable(++gc.epoch, gc);
+            break;
+        case Node::ALTERNATE_LANGUAGE:
+        case Node::SEQUENCE_LANGUAGE:
+            r->kind = (node->type == Node::ALTERNATE_LANGUAGE) ? Rule::CHOICE : Rule::SEQUENCE;
+            r->children.push_back(rule(node->left));
+            r->children.push_back(rule(node->right));
+            break;
+        case Node::UNION_LANGUAGE:
+            r->kind = Rule::CHOICE;
+            for (Node* child : node->children)
+            {
+                r->children.push_back(rule(child));
+            }
+            break;
+        case Node::CONCATENATION_LANGUAGE:
+            r->kind = Rule::SEQUENCE;
+            if (node->left != nullptr) r->children.push_back(rule(node->left));
+            for (std::size_t i = node->offset; i < node->spine->children.size(); ++i)
+            {
+                r->children.push_back(rule(node->spine->children[i]));
+            }
+            break;
+        case Node::REPETITION_LANGUAGE:
+            r->kind = Rule::REPEAT;
+            r->nullable = true;
+            r->children.push_back(rule(node->pattern));
+            break;
+    }
+
+    return r;
+}
+
+template <typename L>
+bool PredictiveMatcher<L>::matches(const char* input, std::size_t size)
+{
+    pinned.pin(gc);
+
+    std::uint64_t counter = ++gc.epoch;
+
+    stack.clear();
+    stack.push_back(entry(root));
+
+    // The derivative being matched, or nullptr while the stack is
+    Node* lang = nullptr;
+    bool matched = true;
+    for (const char* i = input; i != input + size; ++i)
+    {
+        if (lang == nullptr)
+        {
+            Step step = predict(*i);
+            if (step == CONSUMED)
+            {
+                ++counts.predicted;
+                continue;
+            }
+            if (step == FAILED)
+            {
+                matched = false;
+                break;
+            }
+
+            ++counts.fallbacks;
+            lang = language(counter);
+        }
+
+        counter = ++gc.epoch;
+        lang = lang->derive(*i, counter, gc);
+        gc.collect(priv::IsDead<char>(counter));
+        ++counts.derived;
+
+        if (lang->type == Node::NULL_LANGUAGE)
+        {
+            matched = false;
+            break;
+        }
+
+        if (resume(lang))
+        {
+            ++counts.resumes;
+            lang = nullptr;
+        }
+    }
+
+    if (matched)
+    {
+        if (lang != nullptr)
+        {
+            matched = lang->isNullable(counter, gc);
+        }
+        else
+        {
+            for (const Entry& entry : stack)
+            {
+                // A literal is never nullable, even part way through
+                matched = matched && entry.rule->nullable;
+            }
+        }
+    }
+
+    pinned.unpin(gc);
+
+    return matched;
+}
+
+// Matches c against the top of the stack, expanding it until c is consumed or there is
+// no telling what to expand it to
+template <typename L>
+typename PredictiveMatcher<L>::Step PredictiveMatcher<L>::predict(char c)
+{
+    unsigned char b = static_cast<unsigned char>(c);
+
+    // Expanding visits each rule at most once before consuming, unless the grammar is
+    // left recursive: a nullable left recursion such as l = l ("foo" | "bar") | "" can
+    // keep its alternatives' FIRST sets apart, so only this count stops it expanding l
+    // forever, handing the match back to the derivatives instead
+    std::size_t expansions = 0;
+    for (;;)
+    {
+        if (stack.empty()) return FAILED;
+
+        Entry& top = stack.back();
+        const Rule* r = top.rule;
+
+        if (r->kind == Rule::LITERAL)
+        {
+            const std::string& literal = *r->node->literal;
+            if (literal[top.offset] != c) return FAILED;
+            if (++top.offset == literal.size()) stack.pop_back();
+            return CONSUMED;
+        }
+
+        if (!r->first[b])
+        {
+            if (!r->nullable) return FAILED;
+            stack.pop_back();
+            continue;
+        }
+
+        if (++expansions > rules.size()) return FALLBACK;
+
+        switch (r->kind)
+        {
+            case Rule::TERMINAL:
+                stack.pop_back();
+                return CONSUMED;
+            case Rule::SEQUENCE:
+                stack.pop_back();
+                for (std::size_t i = r->children.size(); i-- > 0;)
+                {
+                    stack.push_back(entry(r->children[i]));
+                }
+                break;
+            case Rule::CHOICE:
+                {
+                    std::int16_t pick = r->pick[b];
+                    if (pick < 0) return FALLBACK;
+
+                    // Skipping over a nullable alternative would do as well
+                    if (r->nullableOther[pick] && follows(c, stack.size() - 1)) return FALLBACK;
+
+                    top = entry(r->children[pick]);
+                    break;
+                }
+            case Rule::REPEAT:
+                {
+                    // So would stopping
+                    if (follows(c, stack.size() - 1)) return FALLBACK;
+
+                    stack.push_back(entry(r->children[0]));
+                    break;
+                }
+            default:
+                return FALLBACK;
+        }
+    }
+}
+
+// Whether c can start what the bottom below entries of the stack match
+template <typename L>
+bool PredictiveMatcher<L>::follows(char c, std::size_t below) const
+{
+    unsigned char b = static_cast<unsigned char>(c);
+    for (std::size_t i = below; i-- > 0;)
+    {
+        const Entry& e = stack[i];
+        if (e.rule->kind == Rule::LITERAL) return (*e.rule->node->literal)[e.offset] == c;
+        if (e.rule->first[b]) return true;
+        if (!e.rule->nullable) return false;
+    }
+
+    return false;
+}
+
+// The language the stack matches: its entries in sequence, top first
+template <typename L>
+typename PredictiveMatcher<L>::Node* PredictiveMatcher<L>::language(std::uint64_t counter)
+{
+    Node* lang = &Node::empty;
+    for (const Entry& e : stack)
+    {
+        Node* node = e.rule->node;
+        if (e.rule->kind == Rule::LITERAL && e.offset != node->offset)
+        {
+            Node* lit = gc();
+            lit->marker = counter;
+            lit->memoize = nullptr;
+            lit->anonymous = false;
+            lit->type = Node::LITERAL_LANGUAGE;
+            lit->literal = node->literal;
+            lit->offset = e.offset;
+            node = lit;
+        }
+
+        lang = (lang == &Node::empty) ? node : priv::sequence(gc, node, lang);
+    }
+
+    return lang;
+}
+
+// Turns the stack into lang if it is a sequence of grammar nodes (and literals part
+// way through)
+template <typename L>
+bool PredictiveMatcher<L>::resume(Node* lang)
+{
+    order.clear();
+    visited.clear();
+    if (!items(lang, order)) return false;
+
+    stack.assign(order.rbegin(), order.rend());
+    return true;
+}
+
+// Appends to order what lang is a sequence of, if it is one
+template <typename L>
+bool PredictiveMatcher<L>::items(Node* lang, std::vector<Entry>& order)
+{
+    for (;;)
+    {
+        auto found = index.find(lang);
+        if (found != index.end())
+        {
+            order.push_back(entry(found->second));
+            return true;
+        }
+
+        switch (lang->type)
+        {
+            case Node::EMPTY_LANGUAGE:
+            case Node::EVENT_LANGUAGE:
+                return true;
+            case Node::LITERAL_LANGUAGE:
+                {
+                    auto literal = literals.find(lang->literal.get());
+                    if (literal == literals.end()) return false;
+
+                    order.push_back(Entry{literal->second, lang->offset});
+                    return true;
+                }
+            case Node::SEQUENCE_LANGUAGE:
+                // Derivatives may be cyclic, and then they are no sequence
+                if (!visited.insert(lang).second || !items(lang->left, order)) return false;
+                lang = lang->right;
+                break;
+            case Node::CONCATENATION_LANGUAGE:
+                if (!visited.insert(lang).second) return false;
+                if (lang->left != nullptr && !items(lang->left, order)) return false;
+                for (std::size_t i = lang->offset; i < lang->spine->children.size(); ++i)
+                {
+                    auto child = index.find(lang->spine->children[i]);
+                    if (child == index.end()) return false;
+
+                    order.push_back(entry(child->second));
+                }
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,676 @@
+#ifndef LIB_DERP_SAMPLER_HPP
+#define LIB_DERP_SAMPLER_HPP
+
+#include "Language.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+
+namespace derp
+{
+
+// Writes random sentences of a grammar, for load tests and benchmarks. The grammar is
+// flattened once into a table of choices, sequences and repetitions, and sentences are
+// expanded from it with an explicit stack, so writing one costs little more than its
+// bytes. Alternatives are picked by their weights (one unless weighed), and a
+// repetition goes on with a given probability. Given a target size, a sentence below it
+// only picks alternatives that can grow (through a repetition or recursion), and its
+// repetitions go on more often the further below it is, and less often once above.
+//
+// Once an expansion is maxDepth deep, or the sentence is maxSize bytes long, every
+// choice takes the alternative with the shallowest way out and repetitions stop, so
+// each sentence ends soon after. Sizes are aimed at, not guaranteed: a grammar whose
+// repetitions are few or short cannot reach every target.
+//
+// Sentences are members of the grammar by construction. Intersections and complements
+// cannot be expanded that way: they are sampled from their left side (or from near
+// misses of their pattern) and checked by deriving, which is far slower.
+template <typename L>
+class Sampler
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    explicit Sampler(const L& language, std::uint64_t seed = 1, std::size_t maxDepth = 64, std::size_t maxSize = 4096, double repeat = 0.5, std::size_t targetSize = 0);
+
+    // Makes language weight times as likely to be picked wherever it is an alternative
+    void weigh(const L& language, double weight);
+
+    // Appends a random sentence to out, or returns false if the grammar has none (or
+    // no sentence passed its checks)
+    bool sentence(std::string& out);
+
+    // Appends a random sentence with one small edit (a byte inserted, deleted, replaced
+    // or swapped) that the grammar does not match, or returns false if none was found
+    bool nearMiss(std::string& out);
+
+private:
+    typedef priv::Language<char> Node;
+
+    enum Kind
+    {
+        NOTHING,    // The empty language, or the null one (whose height is infinite)
+        BYTE,       // value
+        LITERAL,    // bytes [first, first + count) of text
+        RANGE,      // count ranges of bytes from first in ranges, covering value bytes
+        CHOICE,     // count alternatives from first in edges
+        SEQUENCE,   // count parts from first in edges
+        REPEAT,     // the pattern at edges[first]
+        FILTER      // a sentence of edges[first], kept if node matches it
+    };
+
+    struct Op
+    {
+        Kind kind;
+        std::uint32_t first;
+        std::uint32_t count;
+        std::uint32_t value;
+
+        // The height of the shallowest expansion, or INFINITE if there is none
+        std::uint32_t height;
+
+        // For CHOICE, the alternative with the least height; for FILTER, whether
+        // candidates are near misses of the pattern rather than sentences of it
+        std::uint32_t shortest;
+
+        // Whether its sentences can be any length, through a repetition or recursion
+        bool open;
+
+        const Node* node;
+    };
+
+    // An op left to expand, or CHECK for the filter at the back of checks
+    struct Frame
+    {
+        std::uint32_t op;
+        std::uint32_t depth;
+    };
+
+    // A filter whose candidate is being written from offset
+    struct Check
+    {
+        std::uint32_t op;
+        std::uint32_t depth;
+        std::size_t offset;
+        std::uint32_t attempts;
+    };
+
+    static const std::uint32_t INFINITE = std::numeric_limits<std::uint32_t>::max();
+    static const std::uint32_t NONE = std::numeric_limits<std::uint32_t>::max();
+    static const std::uint32_t CHECK = NONE - 1;
+
+    // Filters give up on a sentence after this many rejected candidates
+    static const std::uint32_t MAX_ATTEMPTS = 64;
+
+    std::uint32_t index(const Node* node);
+    void solveHeights();
+    void findOpen();
+    void reweigh(std::uint32_t choice);
+
+    std::uint64_t next();
+
+    // A random number less than n, which must fit in 32 bits
+    std::uint64_t below(std::uint64_t n) { return ((next() >> 32) * n) >> 32; }
+
+    std::uint64_t repeatLimit(std::size_t size) const;
+
+    bool expand(std::uint32_t root, std::string& out, std::uint32_t depth);
+    void mutate(std::string& out, std::size_t offset);
+    bool matches(const Node* node, const char* begin, const char* end);
+
+    GarbageCollector& gc;
+    std::size_t maxDepth;
+    std::size_t maxSize;
+    std::size_t targetSize;
+    double repeat;
+    std::uint64_t repeatThreshold;
+    std::uint64_t state;
+
+    std::vector<Op> ops;
+    std::vector<std::uint32_t> edges;
+    std::vector<double> weights;       // Per edge, for CHOICE
+    std::vector<std::uint64_t> limits; // Per edge, for CHOICE: the cumulative weights, scaled to 2^63
+    std::vector<std::uint64_t> openLimits; // Per edge, for CHOICE: the same, over open alternatives
+    std::string text;
+    std::vector<std::pair<unsigned char, unsigned char>> ranges;
+    std::unordered_map<const Node*, std::uint32_t> indices;
+
+    // Bytes the grammar mentions, for the edits of near misses
+    std::string bytes;
+
+    // Where the sentence being written starts in out
+    std::size_t origin;
+
+    std::vector<Frame> stack;
+    std::vector<Check> checks;
+    priv::Pinned<Node> pinned;
+};
+
+template <typename L>
+Sampler<L>::Sampler(const L& language, std::uint64_t seed, std::size_t maxDepth, std::size_t maxSize, double repeat, std::size_t targetSize) :
+    gc(language.gc), maxDepth(maxDepth), maxSize(maxSize), targetSize(targetSize), repeat(repeat),
+    state(seed * 0x9E3779B97F4A7C15ull + 1), origin(0)
+{
+    assert(repeat >= 0 && repeat < 1);
+    repeatThreshold = static_cast<std::uint64_t>(repeat * 18446744073709551616.0);
+
+    bool mentioned[256] = {};
+    auto mention = [&](char c)
+    {
+        mentioned[static_cast<unsigned char>(c)] = true;
+    };
+
+    index(language.l);
+    for (std::uint32_t i = 0; i < ops.size(); ++i)
+    {
+        const Node* node = ops[i].node;
+        std::vector<const Node*> children;
+        node->forEachChild([&](const Node* child) { children.push_back(child); });
+
+        Op op = {NOTHING, 0, 0, 0, INFINITE, 0, false, node};
+        switch (node->type)
+        {
+            case Node::NULL_LANGUAGE:
+            case Node::EMPTY_LANGUAGE:
+            case Node::EVENT_LANGUAGE:
+                break;
+            case Node::TERMINAL_LANGUAGE:
+                op.kind = BYTE;
+                op.value = static_cast<unsigned char>(node->t);
+                mention(node->t);
+                break;
+            case Node::LITERAL_LANGUAGE:
+                op.kind = LITERAL;
+                op.first = static_cast<std::uint32_t>(text.size());
+                op.count = static_cast<std::uint32_t>(node->literal->size() - node->offset);
+                text.append(*node->literal, node->offset, std::string::npos);
+                for (char c : text.substr(op.first)) mention(c);
+                break;
+            case Node::RANGE_LANGUAGE:
+                op.kind = RANGE;
+                op.first = static_cast<std::uint32_t>(ranges.size());
+                for (const std::pair<char, char>& r : *node->ranges)
+                {
+                    unsigned char low = static_cast<unsigned char>(r.first);
+                    unsigned char high = static_cast<unsigned char>(r.second);
+                    ranges.emplace_back(low, high);
+                    op.value += high - low + 1u;
+                    mention(r.first);
+                    mention(r.second);
+                }
+                op.count = static_cast<std::uint32_t>(ranges.size()) - op.first;
+                break;
+            case Node::ALTERNATE_LANGUAGE:
+            case Node::UNION_LANGUAGE:
+                op.kind = CHOICE;
+                break;
+            case Node::SEQUENCE_LANGUAGE:
+            case Node::CONCATENATION_LANGUAGE:
+                op.kind = SEQUENCE;
+                break;
+            case Node::REPETITION_LANGUAGE:
+                op.kind = REPEAT;
+                break;
+            case Node::INTERSECTION_LANGUAGE:
+                op.kind = FILTER;
+                children.resize(1);
+                break;
+            case Node::COMPLEMENT_LANGUAGE:
+                op.kind = FILTER;
+                op.shortest = 1;
+                break;
+            default:
+                // Derivatives are never part of a grammar
+                assert(false);
+                break;
+        }
+
+        if (op.kind == CHOICE || op.kind == SEQUENCE || op.kind == REPEAT || op.kind == FILTER)
+        {
+            op.first = static_cast<std::uint32_t>(edges.size());
+            op.count = static_cast<std::uint32_t>(children.size());
+            // Children are indexed once their edges exist, as that may grow ops
+            edges.resize(edges.size() + children.size());
+            for (std::uint32_t c = 0; c < children.size(); ++c)
+            {
+                std::uint32_t child = index(children[c]);
+                edges[op.first + c] = child;
+            }
+        }
+
+        ops[i] = op;
+    }
+
+    for (std::size_t b = 0; b < 256; ++b)
+    {
+        if (mentioned[b]) bytes += static_cast<char>(b);
+    }
+    if (bytes.empty()) bytes = "a";
+
+    weights.assign(edges.size(), 1.0);
+    limits.assign(edges.size(), 0);
+    openLimits.assign(edges.size(), 0);
+    solveHeights();
+    findOpen();
+    for (std::uint32_t i = 0; i < ops.size(); ++i)
+    {
+        if (ops[i].kind == CHOICE) reweigh(i);
+    }
+}
+
+template <typename L>
+std::uint32_t Sampler<L>::index(const Node* node)
+{
+    auto found = indices.emplace(node, static_cast<std::uint32_t>(ops.size()));
+    if (found.second)
+    {
+        Op op = {NOTHING, 0, 0, 0, INFINITE, 0, false, node};
+        ops.push_back(op);
+    }
+
+    return found.first->second;
+}
+
+// Heights only ever fall from infinite, so relaxing every op until none changes finds
+// the least ones
+template <typename L>
+void Sampler<L>::solveHeights()
+{
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (Op& op : ops)
+        {
+            std::uint32_t height = INFINITE;
+            switch (op.kind)
+            {
+                case NOTHING:
+                    if (op.node->type != Node::NULL_LANGUAGE) height = 0;
+                    break;
+                case BYTE:
+                case LITERAL:
+                case RANGE:
+                case REPEAT:
+                    height = 0;
+                    break;
+                case CHOICE:
+                    for (std::uint32_t e = op.first; e < op.first + op.count; ++e)
+                    {
+                        if (ops[edges[e]].height < height)
+                        {
+                            height = ops[edges[e]].height;
+                            op.shortest = edges[e];
+                        }
+                    }
+                    break;
+                case SEQUENCE:
+                    height = 0;
+                    for (std::uint32_t e = op.first; e < op.first + op.count && height != INFINITE; ++e)
+                    {
+                        if (ops[edges[e]].height >= height) height = ops[edges[e]].height;
+                    }
+                    break;
+                case FILTER:
+                    height = ops[edges[op.first]].height;
+                    break;
+            }
+
+            if (height != INFINITE) ++height;
+            if (height < op.height)
+            {
+                op.height = height;
+                changed = true;
+            }
+        }
+    }
+}
+
+// An op is open if it reaches a repetition, or itself, through ops that have sentences
+template <typename L>
+void Sampler<L>::findOpen()
+{
+    std::vector<bool> seen;
+    std::vector<std::uint32_t> pending;
+    for (std::uint32_t i = 0; i < ops.size(); ++i)
+    {
+        if (ops[i].height == INFINITE) continue;
+
+        seen.assign(ops.size(), false);
+        pending.assign(1, i);
+        while (!pending.empty() && !ops[i].open)
+        {
+            const Op& op = ops[pending.back()];
+            pending.pop_back();
+            if (op.kind == REPEAT)
+            {
+                ops[i].open = ops[edges[op.first]].height != INFINITE;
+                continue;
+            }
+            if (op.kind != CHOICE && op.kind != SEQUENCE && op.kind != FILTER) continue;
+
+            for (std::uint32_t e = op.first; e < op.first + op.count; ++e)
+            {
+                std::uint32_t child = edges[e];
+                if (ops[child].height == INFINITE || seen[child]) continue;
+                if (child == i) ops[i].open = true;
+                seen[child] = true;
+                pending.push_back(child);
+            }
+        }
+    }
+}
+
+// Scales the weights of a choice's alternatives into cumulative limits on a random
+// 63-bit number, leaving out alternatives with no sentences. If every weight is zero,
+// the alternatives are picked evenly instead. The open limits also leave out closed
+// alternatives, unless every alternative is closed.
+template <typename L>
+void Sampler<L>::reweigh(std::uint32_t choice)
+{
+    const Op& op = ops[choice];
+    bool anyOpen = false;
+    for (std::uint32_t e = op.first; e < op.first + op.count; ++e)
+    {
+        if (ops[edges[e]].height != INFINITE && ops[edges[e]].open) anyOpen = true;
+    }
+
+    auto scale = [&](std::vector<std::uint64_t>& table, bool openOnly)
+    {
+        auto picked = [&](std::uint32_t e)
+        {
+            return ops[edges[e]].height != INFINITE && (!openOnly || ops[edges[e]].open);
+        };
+
+        double total = 0;
+        std::uint32_t last = op.first;
+        for (std::uint32_t e = op.first; e < op.first + op.count; ++e)
+        {
+            if (!picked(e)) continue;
+            total += weights[e];
+            last = e;
+        }
+
+        double sum = 0;
+        for (std::uint32_t e = op.first; e < op.first + op.count; ++e)
+        {
+            if (picked(e)) sum += (total > 0) ? weights[e] : 1;
+            table[e] = static_cast<std::uint64_t>(sum / ((total > 0) ? total : sum) * 9223372036854775808.0);
+        }
+
+        // Rounding must not leave the last alternative short of 2^63
+        table[last] = std::uint64_t(1) << 63;
+    };
+
+    scale(limits, false);
+    scale(openLimits, anyOpen);
+}
+
+template <typename L>
+void Sampler<L>::weigh(const L& language, double weight)
+{
+    assert(weight >= 0);
+
+    auto found = indices.find(language.l);
+    if (found == indices.end()) return;
+
+    for (std::uint32_t i = 0; i < ops.size(); ++i)
+    {
+        if (ops[i].kind != CHOICE) continue;
+
+        bool changed = false;
+        for (std::uint32_t e = ops[i].first; e < ops[i].first + ops[i].count; ++e)
+        {
+            if (edges[e] != found->second) continue;
+            weights[e] = weight;
+            changed = true;
+        }
+        if (changed) reweigh(i);
+    }
+}
+
+// xorshift64*
+template <typename L>
+std::uint64_t Sampler<L>::next()
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1Dull;
+}
+
+// The chance, scaled to 2^64, that a repetition goes on once the sentence is size bytes
+// long. Below the target, stopping is less likely by the square of how far short the
+// sentence is, down to about once in twice the target (so a pattern that writes nothing
+// still stops); above it, going on is less likely the further over the sentence is.
+template <typename L>
+std::uint64_t Sampler<L>::repeatLimit(std::size_t size) const
+{
+    if (targetSize == 0) return repeatThreshold;
+
+    double ratio = (size + 1.0) / (targetSize + 1.0);
+    double chance = (size < targetSize) ? 1 - (1 - repeat) * std::max(ratio * ratio, 1 / (targetSize + 1.0))
+                                        : repeat * targetSize / size;
+    if (chance >= 1) return std::numeric_limits<std::uint64_t>::max();
+    return static_cast<std::uint64_t>(chance * 18446744073709551616.0);
+}
+
+template <typename L>
+bool Sampler<L>::sentence(std::string& out)
+{
+    if (ops[0].height == INFINITE) return false;
+
+    std::size_t size = out.size();
+    origin = size;
+    for (std::uint32_t attempt = 0; attempt < MAX_ATTEMPTS; ++attempt)
+    {
+        if (expand(0, out, 0)) return true;
+        out.resize(size);
+    }
+
+    return false;
+}
+
+// Expands op root onto out, returning false if a filter gave up. The op to expand next
+// is kept out of the stack, so only the rest of sequences and repetitions are pushed.
+template <typename L>
+bool Sampler<L>::expand(std::uint32_t root, std::string& out, std::uint32_t depth)
+{
+    const std::size_t base = stack.size();
+    const std::size_t checkBase = checks.size();
+
+    auto fail = [&]
+    {
+        stack.resize(base);
+        checks.resize(checkBase);
+        return false;
+    };
+
+    std::uint32_t current = root;
+    bool retry = false;
+    for (;;)
+    {
+        if (current == NONE)
+        {
+            if (stack.size() == base) return true;
+
+            current = stack.back().op;
+            depth = stack.back().depth;
+            stack.pop_back();
+            if (current != CHECK) continue;
+
+            Check& check = checks.back();
+            current = NONE;
+            if (matches(ops[check.op].node, out.data() + check.offset, out.data() + out.size()))
+            {
+                checks.pop_back();
+                continue;
+            }
+
+            out.resize(check.offset);
+            if (++check.attempts == MAX_ATTEMPTS) return fail();
+
+            current = check.op;
+            depth = check.depth;
+            retry = true;
+        }
+
+        const Op& op = ops[current];
+        bool exhausted = depth >= maxDepth || out.size() - origin >= maxSize;
+        switch (op.kind)
+        {
+            case NOTHING:
+                current = NONE;
+                break;
+            case BYTE:
+                out += static_cast<char>(op.value);
+                current = NONE;
+                break;
+            case LITERAL:
+                out.append(text, op.first, op.count);
+                current = NONE;
+                break;
+            case RANGE:
+                {
+                    std::uint32_t pick = static_cast<std::uint32_t>(below(op.value));
+                    for (std::uint32_t r = op.first;; ++r)
+                    {
+                        std::uint32_t width = ranges[r].second - ranges[r].first + 1u;
+                        if (pick < width)
+                        {
+                            out += static_cast<char>(ranges[r].first + pick);
+                            break;
+                        }
+                        pick -= width;
+                    }
+                    current = NONE;
+                }
+                break;
+            case CHOICE:
+                if (exhausted)
+                {
+                    current = op.shortest;
+                }
+                else
+                {
+                    // Below the target, only alternatives that can keep growing are picked
+                    const std::vector<std::uint64_t>& table = (out.size() - origin < targetSize) ? openLimits : limits;
+                    std::uint64_t pick = next() >> 1;
+                    std::uint32_t e = op.first;
+                    while (table[e] <= pick) ++e;
+                    current = edges[e];
+                }
+                ++depth;
+                break;
+            case SEQUENCE:
+                if (op.count == 0)
+                {
+                    current = NONE;
+                    break;
+                }
+                for (std::uint32_t e = op.first + op.count; --e > op.first;)
+                {
+                    stack.push_back(Frame{edges[e], depth + 1});
+                }
+                current = edges[op.first];
+                ++depth;
+                break;
+            case REPEAT:
+                // Going on is not deeper, so depth limits nesting rather than the length
+                // of a repetition
+                if (!exhausted && ops[edges[op.first]].height != INFINITE && next() < repeatLimit(out.size() - origin))
+                {
+                    stack.push_back(Frame{current, depth});
+                    current = edges[op.first];
+                    ++depth;
+                }
+                else
+                {
+                    current = NONE;
+                }
+                break;
+            case FILTER:
+                // The candidate is checked once it is written
+                if (!retry) checks.push_back(Check{current, depth, out.size(), 0});
+                retry = false;
+                stack.push_back(Frame{CHECK, 0});
+                if (op.shortest == 0)
+                {
+                    current = edges[op.first];
+                    ++depth;
+                }
+                else
+                {
+                    std::size_t offset = checks.back().offset;
+                    if (!expand(edges[op.first], out, depth + 1)) return fail();
+                    mutate(out, offset);
+                    current = NONE;
+                }
+                break;
+        }
+    }
+}
+
+// Makes one random edit to out from offset on
+template <typename L>
+void Sampler<L>::mutate(std::string& out, std::size_t offset)
+{
+    std::size_t size = out.size() - offset;
+    char byte = bytes[below(bytes.size())];
+    switch (size == 0 ? 0 : below(4))
+    {
+        case 0:
+            out.insert(out.begin() + offset + (size == 0 ? 0 : below(size + 1)), byte);
+            break;
+        case 1:
+            out.erase(offset + below(size), 1);
+            break;
+        case 2:
+            out[offset + below(size)] = byte;
+            break;
+        case 3:
+            if (size > 1)
+            {
+                std::size_t i = offset + below(size - 1);
+                std::swap(out[i], out[i + 1]);
+            }
+            else
+            {
+                out += out[offset];
+            }
+            break;
+    }
+}
+
+template <typename L>
+bool Sampler<L>::matches(const Node* node, const char* begin, const char* end)
+{
+    return priv::matches(begin, end, const_cast<Node*>(node), gc, pinned);
+}
+
+template <typename L>
+bool Sampler<L>::nearMiss(std::string& out)
+{
+    std::size_t size = out.size();
+    for (std::uint32_t attempt = 0; attempt < MAX_ATTEMPTS; ++attempt)
+    {
+        if (!sentence(out)) return false;
+
+        mutate(out, size);
+        if (!matches(ops[0].node, out.data() + size, out.data() + out.size())) return true;
+
+        out.resize(size);
+    }
+
+    return false;
+}
+
+} // namespace derp
+
+#endif
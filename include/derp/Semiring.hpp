@@ -0,0 +1,148 @@
+#ifndef LIB_DERP_SEMIRING_HPP
+#define LIB_DERP_SEMIRING_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace derp
+{
+
+// Semirings weigh the parses of an input (see Weigher). Each gives a Value type that
+// compares with ==, and:
+//
+//   zero()       the weight of no parse at all
+//   one()        the weight of the parse of the empty word
+//   plus(a, b)   the weight of the parses of either a or b
+//   times(a, b)  the weight of the parses of a followed by those of b
+//
+// The weights of cyclic grammars are found by iterating until nothing changes. What
+// still changes after rounds passes per node is given to diverge(), which returns the
+// weight it tends to.
+
+// Whether there is a parse at all
+struct Boolean
+{
+    typedef bool Value;
+
+    static const std::size_t rounds = 1;
+
+    static Value zero() { return false; }
+    static Value one() { return true; }
+    static Value plus(Value a, Value b) { return a || b; }
+    static Value times(Value a, Value b) { return a && b; }
+    static Value diverge(Value a) { return a; }
+};
+
+// The number of parses. It saturates at infinite(), which also stands for infinitely
+// many parses (of grammars that can go around a cycle without consuming input).
+struct Counting
+{
+    typedef std::uint64_t Value;
+
+    static const std::size_t rounds = 1;
+
+    static Value infinite() { return std::numeric_limits<Value>::max(); }
+
+    static Value zero() { return 0; }
+    static Value one() { return 1; }
+
+    static Value plus(Value a, Value b)
+    {
+        return (a > infinite() - b) ? infinite() : a + b;
+    }
+
+    static Value times(Value a, Value b)
+    {
+        if (a == 0 || b == 0) return 0;
+        return (a > infinite() / b) ? infinite() : a * b;
+    }
+
+    static Value diverge(Value) { return infinite(); }
+};
+
+// The lowest cost of a parse, adding up the costs of the languages it goes through.
+// Costs must not be negative; no parse at all costs infinity.
+struct Tropical
+{
+    typedef double Value;
+
+    static const std::size_t rounds = 1;
+
+    static Value zero() { return std::numeric_limits<double>::infinity(); }
+    static Value one() { return 0.0; }
+    static Value plus(Value a, Value b) { return std::min(a, b); }
+    static Value times(Value a, Value b) { return a + b; }
+    static Value diverge(Value a) { return a; }
+};
+
+// The K lowest costs of parses, lowest first, as for Tropical. Missing parses cost
+// infinity.
+template <std::size_t K>
+struct KBest
+{
+    struct Value
+    {
+        Value()
+        {
+            costs.fill(std::numeric_limits<double>::infinity());
+        }
+
+        // A single parse of the given cost
+        Value(double cost) :
+            Value()
+        {
+            costs[0] = cost;
+        }
+
+        bool operator== (const Value& other) const { return costs == other.costs; }
+        bool operator!= (const Value& other) const { return costs != other.costs; }
+
+        double operator[] (std::size_t i) const { return costs[i]; }
+
+        std::array<double, K> costs;
+    };
+
+    static const std::size_t rounds = K;
+
+    static Value zero() { return Value(); }
+    static Value one() { return Value(0.0); }
+
+    static Value plus(const Value& a, const Value& b)
+    {
+        std::array<double, 2 * K> both;
+        std::merge(a.costs.begin(), a.costs.end(), b.costs.begin(), b.costs.end(), both.begin());
+
+        Value sum;
+        std::copy(both.begin(), both.begin() + K, sum.costs.begin());
+        return sum;
+    }
+
+    static Value times(const Value& a, const Value& b)
+    {
+        // Both are sorted, so only pairs with i + j < K can be among the K lowest
+        std::array<double, K * (K + 1) / 2> sums;
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < K; ++i)
+        {
+            for (std::size_t j = 0; i + j < K; ++j)
+            {
+                sums[n++] = a.costs[i] + b.costs[j];
+            }
+        }
+
+        std::partial_sort(sums.begin(), sums.begin() + K, sums.end());
+
+        Value product;
+        std::copy(sums.begin(), sums.begin() + K, product.costs.begin());
+        return product;
+    }
+
+    static Value diverge(const Value& a) { return a; }
+};
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef LIB_DERP_SESSION_HPP
+#define LIB_DERP_SESSION_HPP
+
+#include "Language.hpp"
+#include "priv/BudgetAllocator.hpp"
+
+#include <chrono>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace derp
+{
+
+// How much work a step of a session may do before it suspends: a number of tokens, of
+// nodes visited by derivations, and an amount of time. A derivation that uses up the
+// visits or the time is given up partway, and derived again by the next step, except
+// for the first of a step: that one always finishes, so a step may overrun the budget
+// by what a single derivation takes.
+struct Budget
+{
+    std::size_t tokens;
+    std::size_t visits;
+    std::chrono::nanoseconds time;
+
+    explicit Budget(std::size_t tokens = std::numeric_limits<std::size_t>::max(),
+                    std::size_t visits = std::numeric_limits<std::size_t>::max(),
+                    std::chrono::nanoseconds time = std::chrono::nanoseconds::max()) :
+        tokens(tokens), visits(visits), time(time)
+    {
+    }
+
+    static Budget ofTokens(std::size_t tokens) { return Budget(tokens); }
+    static Budget ofVisits(std::size_t visits) { return Budget(std::numeric_limits<std::size_t>::max(), visits); }
+    static Budget ofTime(std::chrono::nanoseconds time) { return Budget(std::numeric_limits<std::size_t>::max(), std::numeric_limits<std::size_t>::max(), time); }
+};
+
+// Matches an input a slice at a time, for callers (such as event loops) that must not
+// be kept busy long by any one call. Each step derives tokens until its budget is used
+// up and then suspends; the next step goes on from there. Between steps the derivative
+// is kept out of the collector's reach, as StreamParser keeps its own, so other matches
+// (and other sessions) may use the collector meanwhile.
+//
+// A step always derives at least one token, so it only goes over its budget when that
+// token alone takes more. Later tokens are given up as soon as the budget runs out,
+// throwing away what their derivation had built, and are derived from the start by the
+// next step. The input must outlive the session.
+template <typename L>
+class Session
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    enum Status
+    {
+        SUSPENDED,
+        MATCHED,
+        FAILED
+    };
+
+    Session(const L& language, const char* input, std::size_t size) :
+        gc(language.gc), lang(language.l), i(input), end(input + size), position(0), current(SUSPENDED)
+    {
+    }
+
+    Session(const L& language, const std::string& input) :
+        Session(language, input.data(), input.size())
+    {
+    }
+
+    ~Session();
+
+    Session(const Session<L>&) = delete;
+    Session<L>& operator= (const Session<L>&) = delete;
+
+    // Derives the input until the budget is used up, or until the match is decided
+    Status step(const Budget& budget);
+
+    Status status() const { return current; }
+
+    // How many tokens were derived
+    std::size_t offset() const { return position; }
+
+private:
+    typedef priv::Language<char> Node;
+    typedef std::chrono::steady_clock Clock;
+
+    GarbageCollector& gc;
+    Node* lang;
+    const char* i;
+    const char* end;
+    std::size_t position;
+    Status current;
+
+    // The nodes of the current derivative while suspended
+    std::vector<Node*> derivative;
+};
+
+template <typename L>
+Session<L>::~Session()
+{
+    gc.release(derivative, [](const Node*) { return true; });
+}
+
+template <typename L>
+typename Session<L>::Status Session<L>::step(const Budget& budget)
+{
+    if (current != SUSPENDED) return current;
+
+    Clock::time_point start = Clock::now();
+    bool timed = budget.time != std::chrono::nanoseconds::max();
+
+    // Everything else the collector holds (the grammar included) is kept out of reach
+    // while this derivative is collected
+    std::vector<Node*> others;
+    gc.steal(others);
+    gc.give(derivative);
+
+    priv::BudgetAllocator<char, GarbageCollector> allocate(gc);
+    for (std::size_t tokens = 0; i != end;)
+    {
+        std::uint64_t counter = ++gc.epoch;
+        Node* derived = lang->derive(*i, counter, allocate);
+
+        // Nothing is collected, as the nodes this derivation did not reach yet are no
+        // longer marked as alive. The next step's first collection frees what it built.
+        if (allocate.aborted) break;
+
+        lang = derived;
+        gc.collect(priv::IsDead<char>(counter));
+        ++i;
+        ++position;
+
+        if (lang->type == Node::NULL_LANGUAGE)
+        {
+            current = FAILED;
+            break;
+        }
+
+        if (++tokens >= budget.tokens || allocate.visits >= budget.visits) break;
+        if (timed && Clock::now() - start >= budget.time) break;
+
+        // Only the first token must finish; later ones give up once the budget runs out
+        allocate.maxVisits = budget.visits;
+        if (timed) allocate.deadline = start + std::chrono::duration_cast<Clock::duration>(budget.time);
+    }
+
+    if (current == SUSPENDED && i == end)
+    {
+        current = lang->isNullable(++gc.epoch, gc) ? MATCHED : FAILED;
+    }
+
+    if (current == SUSPENDED)
+    {
+        gc.steal(derivative);
+    }
+    else
+    {
+        lang = &Node::null;
+        gc.collect();
+    }
+    gc.give(others);
+
+    return current;
+}
+
+} // namespace derp
+
+#endif
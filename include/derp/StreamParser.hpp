@@ -0,0 +1,347 @@
+#ifndef LIB_DERP_STREAM_PARSER_HPP
+#define LIB_DERP_STREAM_PARSER_HPP
+
+#include "Language.hpp"
+#include "priv/EventAllocator.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+
+namespace derp
+{
+
+// Parses input fed in pieces, calling handler.enter(name, offset) and
+// handler.exit(name, offset) where the named languages start and end, without building
+// a tree. Named languages are the ones given with names, as for toString().
+//
+// Each named language is wrapped in events that the derivatives record as they skip
+// past them. An event is passed to the handler as soon as every parse still possible
+// records it first, so it can never be revised, and is then dropped from the
+// derivative. This keeps memory bounded however long the input is, as long as the
+// grammar decides between its parses within a bounded distance. At the end of the input, an ambiguous parse reports the
+// events of its first alternatives.
+template <typename L, typename H>
+class StreamParser
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    template <typename C = std::vector<std::pair<L, std::string>>>
+    StreamParser(const L& language, const C& names, H& handler);
+    ~StreamParser();
+
+    StreamParser(const StreamParser<L, H>&) = delete;
+    StreamParser<L, H>& operator= (const StreamParser<L, H>&) = delete;
+
+    // Returns false once no continuation of the input can match
+    bool feed(const char* data, std::size_t size);
+    bool feed(const std::string& data) { return feed(data.data(), data.size()); }
+
+    // Ends the input, returning whether it matched
+    bool finish();
+
+    // How much input was fed
+    std::size_t offset() const { return position; }
+
+private:
+    typedef priv::Language<char> Node;
+
+    void emitLeading();
+    bool leading(Node* lang, std::vector<Node*>& events, unsigned int& budget);
+    Node* strip(Node* lang, std::size_t& count);
+    void first(Node* lang, std::vector<Node*>& events);
+    void emit(Node* evt);
+
+    GarbageCollector& gc;
+    H& handler;
+    std::vector<std::string> names;
+
+    // The wrapped copy of the grammar, and the nodes of the current derivative, both
+    // kept out of the collector's reach between calls
+    std::vector<Node*> grammar;
+    std::vector<Node*> derivative;
+
+    priv::EventAllocator<char, GarbageCollector> allocate;
+    Node* lang;
+    std::size_t position;
+    bool finished;
+
+    std::vector<Node*> events;
+};
+
+template <typename L, typename H>
+template <typename C>
+StreamParser<L, H>::StreamParser(const L& language, const C& c, H& handler) :
+    gc(language.gc), handler(handler), allocate(language.gc), lang(nullptr), position(0), finished(false)
+{
+    std::unordered_map<const Node*, std::size_t> named;
+    for (const auto& i : c)
+    {
+        if (named.emplace(i.first.l, names.size()).second) names.push_back(i.second);
+    }
+
+    std::vector<Node*> others;
+    gc.steal(others);
+
+    // Copy every node of the grammar, standing each named one in for the sequence of
+    // its start event, its copy, and its end event
+    std::unordered_map<const Node*, Node*> image;
+    priv::copy<char>(gc, {language.l}, image, [&](const Node* node, Node* copy) -> Node*
+    {
+        auto name = named.find(node);
+        if (name == named.end()) return copy;
+
+        return priv::sequence(gc, priv::event<char>(gc, name->second, false),
+            priv::sequence(gc, copy, priv::event<char>(gc, name->second, true)));
+    });
+
+    lang = image[language.l];
+
+    gc.steal(grammar);
+    gc.give(others);
+}
+
+template <typename L, typename H>
+StreamParser<L, H>::~StreamParser()
+{
+    auto all = [](const Node*) { return true; };
+    gc.release(derivative, all);
+    gc.release(grammar, all);
+}
+
+template <typename L, typename H>
+bool StreamParser<L, H>::feed(const char* data, std::size_t size)
+{
+    assert(!finished);
+
+    std::vector<Node*> others;
+    gc.steal(others);
+    gc.give(derivative);
+
+    for (std::size_t i = 0; i < size && lang->type != Node::NULL_LANGUAGE; ++i)
+    {
+        allocate.offset = position;
+        allocate.nulled.clear();
+
+        std::uint64_t counter = ++gc.epoch;
+        lang = lang->derive(data[i], counter, allocate);
+        gc.collect(priv::IsDead<char>(counter));
+
+        emitLeading();
+
+        ++position;
+    }
+
+    gc.steal(derivative);
+    gc.give(others);
+
+    return lang->type != Node::NULL_LANGUAGE;
+}
+
+template <typename L, typename H>
+bool StreamParser<L, H>::finish()
+{
+    assert(!finished);
+    finished = true;
+
+    std::vector<Node*> others;
+    gc.steal(others);
+    gc.give(derivative);
+
+    allocate.offset = position;
+    allocate.nulled.clear();
+
+    std::uint64_t counter = ++gc.epoch;
+    bool matched = lang->isNullable(counter, allocate);
+    if (matched)
+    {
+        // What remains are the events of the null parses of the derivative
+        Node* rest = allocate.nullParse(lang, counter);
+
+        events.clear();
+        first(rest, events);
+        for (Node* evt : events)
+        {
+            emit(evt);
+        }
+    }
+
+    gc.collect();
+    gc.give(others);
+
+    return matched;
+}
+
+// Passes on the events every remaining parse starts with, and drops them from the
+// derivative
+template <typename L, typename H>
+void StreamParser<L, H>::emitLeading()
+{
+    events.clear();
+    unsigned int budget = 256;
+    leading(lang, events, budget);
+    if (events.empty()) return;
+
+    for (Node* evt : events)
+    {
+        emit(evt);
+    }
+
+    std::size_t count = events.size();
+    lang = strip(lang, count);
+    assert(count == 0);
+}
+
+// Appends the events that every parse of lang records first, as far as budget allows,
+// and returns whether lang consists of nothing but recorded events
+template <typename L, typename H>
+bool StreamParser<L, H>::leading(Node* lang, std::vector<Node*>& events, unsigned int& budget)
+{
+    if (budget == 0) return false;
+    --budget;
+
+    switch (lang->type)
+    {
+        case Node::EMPTY_LANGUAGE:
+            return true;
+        case Node::EVENT_LANGUAGE:
+            if (lang->offset == std::string::npos) return false;
+            events.push_back(lang);
+            return true;
+        case Node::SEQUENCE_LANGUAGE:
+            return leading(lang->left, events, budget) && leading(lang->right, events, budget);
+        case Node::CONCATENATION_LANGUAGE:
+            if (lang->left != nullptr) leading(lang->left, events, budget);
+            return false;
+        case Node::ALTERNATE_LANGUAGE:
+        case Node::UNION_LANGUAGE:
+            {
+                std::vector<Node*> children;
+                if (lang->type == Node::ALTERNATE_LANGUAGE)
+                {
+                    children.push_back(lang->left);
+                    children.push_back(lang->right);
+                }
+                else
+                {
+                    children = lang->children;
+                }
+
+                std::vector<std::vector<Node*>> alternatives(children.size());
+                bool complete = true;
+                for (std::size_t i = 0; i < children.size(); ++i)
+                {
+                    if (!leading(children[i], alternatives[i], budget)) complete = false;
+                }
+
+                // Only the events all alternatives agree on are certain
+                std::size_t common = alternatives[0].size();
+                for (const std::vector<Node*>& alternative : alternatives)
+                {
+                    std::size_t n = 0;
+                    while (n < common && n < alternative.size() && alternative[n] == alternatives[0][n]) ++n;
+                    if (n != alternative.size()) complete = false;
+                    common = n;
+                }
+
+                events.insert(events.end(), alternatives[0].begin(), alternatives[0].begin() + common);
+                return complete && common == alternatives[0].size();
+            }
+        default:
+            return false;
+    }
+}
+
+// Returns lang without the first count events of each of its parses, which leading()
+// found they all share, copying the nodes on the way to them (the same event node may
+// also stand further on in a parse, so it is never changed)
+template <typename L, typename H>
+priv::Language<char>* StreamParser<L, H>::strip(Node* lang, std::size_t& count)
+{
+    if (count == 0) return lang;
+
+    switch (lang->type)
+    {
+        case Node::EVENT_LANGUAGE:
+            --count;
+            return &Node::empty;
+        case Node::SEQUENCE_LANGUAGE:
+            {
+                Node* left = strip(lang->left, count);
+                Node* right = strip(lang->right, count);
+                if (left->type == Node::EMPTY_LANGUAGE) return right;
+                return priv::sequence(gc, left, right);
+            }
+        case Node::ALTERNATE_LANGUAGE:
+            {
+                std::size_t n = count;
+                Node* left = strip(lang->left, n);
+                Node* right = strip(lang->right, count);
+                assert(n == count);
+                return priv::alternate(gc, left, right);
+            }
+        case Node::UNION_LANGUAGE:
+        case Node::CONCATENATION_LANGUAGE:
+            {
+                Node* copy = gc.allocate();
+                *copy = *lang;
+                copy->marker = 0;
+                copy->memoize = nullptr;
+                copy->leastFixedPointFound = false;
+
+                if (lang->type == Node::CONCATENATION_LANGUAGE)
+                {
+                    copy->left = strip(lang->left, count);
+                    return copy;
+                }
+
+                std::size_t n = count;
+                for (Node*& child : copy->children)
+                {
+                    n = count;
+                    child = strip(child, n);
+                }
+                count = n;
+                return copy;
+            }
+        default:
+            assert(false);
+            return lang;
+    }
+}
+
+// Appends the events of the first null parse of a language of recorded events
+template <typename L, typename H>
+void StreamParser<L, H>::first(Node* lang, std::vector<Node*>& events)
+{
+    switch (lang->type)
+    {
+        case Node::EVENT_LANGUAGE:      events.push_back(lang); return;
+        case Node::SEQUENCE_LANGUAGE:   first(lang->left, events); first(lang->right, events); return;
+        case Node::ALTERNATE_LANGUAGE:  first(lang->left, events); return;
+        case Node::UNION_LANGUAGE:      first(lang->children[0], events); return;
+        default:                        return;
+    }
+}
+
+template <typename L, typename H>
+void StreamParser<L, H>::emit(Node* evt)
+{
+    const std::string& name = names[evt->event >> 1];
+    if (evt->event & 1)
+    {
+        handler.exit(name, evt->offset);
+    }
+    else
+    {
+        handler.enter(name, evt->offset);
+    }
+}
+
+} // namespace derp
+
+#endif
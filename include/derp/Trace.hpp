@@ -0,0 +1,299 @@
+#ifndef LIB_DERP_TRACE_HPP
+#define LIB_DERP_TRACE_HPP
+
+#include "Language.hpp"
+#include "priv/TraceAllocator.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <cassert>
+
+namespace derp
+{
+
+// What happened while deriving one input position
+struct TraceStep
+{
+    std::size_t position;
+    unsigned char byte;
+    std::size_t nodes;       // Nodes reachable from the derivative afterwards
+    std::size_t allocations; // Nodes allocated for the derivative
+    std::size_t fresh;       // Of those, the ones the derivative still reaches
+    std::size_t derives;     // Calls to derive(), memo hits included
+    std::size_t memoHits;    // Derivatives found in a memo
+    std::size_t survivors;   // Derived nodes left alive by the garbage collector
+};
+
+// Records how the derivative evolves while matching, for tuning grammars. Unlike
+// toString(), exporting never touches the nodes' markers.
+template <typename L>
+class Trace
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    Trace(GarbageCollector& gc) : gc(gc), root(nullptr) {}
+
+    // Matches like derp::matches(), but derives every position, including runs that
+    // matches() would skip, and records a step for each
+    bool matches(const std::string& input, const L& language);
+
+    const std::vector<TraceStep>& steps() const { return trace; }
+
+    std::string toCsv() const;
+    std::string toJson() const;
+
+    // The grammar as a Graphviz graph, with each node shaded by how often it was derived
+    std::string toDot() const;
+    template <typename C>
+    std::string toDot(const C& c) const;
+
+private:
+    typedef priv::Language<char> Node;
+
+    static std::unordered_set<const Node*> reachable(const Node* lang);
+    static std::string escape(const std::string& str);
+
+    GarbageCollector& gc;
+    const Node* root;
+    std::vector<TraceStep> trace;
+    std::unordered_map<const Node*, std::size_t> heat;
+};
+
+template <typename L>
+bool Trace<L>::matches(const std::string& input, const L& language)
+{
+    assert(&gc == &language.gc);
+
+    root = language.l;
+    trace.clear();
+    heat.clear();
+
+    priv::Pinned<Node> pinned;
+    pinned.pin(gc);
+
+    for (Node* l : pinned.nodes())
+    {
+        heat.emplace(l, 0);
+    }
+
+    std::uint64_t counter = ++gc.epoch;
+
+    priv::TraceAllocator<char, GarbageCollector> allocate(gc, heat);
+    Node* lang = language.l;
+    for (std::size_t i = 0; i < input.size(); ++i)
+    {
+        allocate.allocations = 0;
+        allocate.derives = 0;
+        allocate.memoHits = 0;
+        allocate.allocated.clear();
+
+        counter = ++gc.epoch;
+        lang = lang->derive(input[i], counter, allocate);
+        gc.collect(priv::IsDead<char>(counter));
+
+        TraceStep step;
+        step.position = i;
+        step.byte = static_cast<unsigned char>(input[i]);
+        std::unordered_set<const Node*> reached = reachable(lang);
+        step.nodes = reached.size();
+        step.allocations = allocate.allocations;
+        step.fresh = std::count_if(allocate.allocated.begin(), allocate.allocated.end(), [&](const Node* node)
+        {
+            return reached.count(node) != 0;
+        });
+        step.derives = allocate.derives;
+        step.memoHits = allocate.memoHits;
+        step.survivors = gc.alive.size();
+        trace.push_back(step);
+    }
+
+    bool matched = lang->isNullable(counter, allocate);
+
+    pinned.unpin(gc);
+
+    return matched;
+}
+
+template <typename L>
+std::string Trace<L>::toCsv() const
+{
+    std::string csv = "position,byte,nodes,allocations,fresh,derives,memo_hits,survivors\n";
+    for (const TraceStep& step : trace)
+    {
+        csv += std::to_string(step.position) + "," +
+            std::to_string(step.byte) + "," +
+            std::to_string(step.nodes) + "," +
+            std::to_string(step.allocations) + "," +
+            std::to_string(step.fresh) + "," +
+            std::to_string(step.derives) + "," +
+            std::to_string(step.memoHits) + "," +
+            std::to_string(step.survivors) + "\n";
+    }
+
+    return csv;
+}
+
+template <typename L>
+std::string Trace<L>::toJson() const
+{
+    std::string json = "[";
+    for (std::size_t i = 0; i < trace.size(); ++i)
+    {
+        const TraceStep& step = trace[i];
+        json += (i == 0) ? "\n" : ",\n";
+        json += "  {\"position\": " + std::to_string(step.position) +
+            ", \"byte\": " + std::to_string(step.byte) +
+            ", \"nodes\": " + std::to_string(step.nodes) +
+            ", \"allocations\": " + std::to_string(step.allocations) +
+            ", \"fresh\": " + std::to_string(step.fresh) +
+            ", \"derives\": " + std::to_string(step.derives) +
+            ", \"memo_hits\": " + std::to_string(step.memoHits) +
+            ", \"survivors\": " + std::to_string(step.survivors) + "}";
+    }
+
+    return json + "\n]\n";
+}
+
+template <typename L>
+std::string Trace<L>::toDot() const
+{
+    return toDot(std::vector<std::pair<L, std::string>>());
+}
+
+template <typename L>
+template <typename C>
+std::string Trace<L>::toDot(const C& c) const
+{
+    std::unordered_map<const Node*, std::string> names;
+    for (const auto& i : c)
+    {
+        names.emplace(i.first.l, i.second);
+    }
+
+    // Number the grammar nodes in the order they are reached from the root
+    std::unordered_map<const Node*, std::size_t> ids;
+    std::vector<const Node*> nodes;
+    if (root != nullptr)
+    {
+        ids.emplace(root, 0);
+        nodes.push_back(root);
+    }
+
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+        nodes[i]->forEachChild([&](const Node* child)
+        {
+            if (ids.emplace(child, nodes.size()).second) nodes.push_back(child);
+        });
+    }
+
+    std::size_t hottest = 1;
+    for (const Node* node : nodes)
+    {
+        auto h = heat.find(node);
+        if (h != heat.end()) hottest = std::max(hottest, h->second);
+    }
+
+    std::string dot = "digraph derivatives {\n    node [style=filled];\n";
+    for (const Node* node : nodes)
+    {
+        std::string label;
+        auto name = names.find(node);
+        if (name != names.end())
+        {
+            label = name->second;
+        }
+        else
+        {
+            switch (node->type)
+            {
+                case Node::LAZY_LANGUAGE:          label = "lazy"; break;
+                case Node::NULL_LANGUAGE:          label = "\u2205"; break;
+                case Node::EMPTY_LANGUAGE:         label = "\u025B"; break;
+                case Node::TERMINAL_LANGUAGE:      label = "'" + std::string(1, node->t) + "'"; break;
+                case Node::ALTERNATE_LANGUAGE:     label = "|"; break;
+                case Node::SEQUENCE_LANGUAGE:      label = "&"; break;
+                case Node::REPETITION_LANGUAGE:    label = "*"; break;
+                case Node::UNION_LANGUAGE:         label = "|"; break;
+                case Node::CONCATENATION_LANGUAGE: label = "&"; break;
+                case Node::LITERAL_LANGUAGE:       label = "\"" + *node->literal + "\""; break;
+                case Node::EVENT_LANGUAGE:         label = (node->event & 1) ? "exit" : "enter"; break;
+                case Node::RANGE_LANGUAGE:         label = priv::text(*node->ranges); break;
+                case Node::INTERSECTION_LANGUAGE:  label = "&&"; break;
+                case Node::COMPLEMENT_LANGUAGE:    label = "!"; break;
+            }
+        }
+
+        auto h = heat.find(node);
+        std::size_t derived = (h != heat.end()) ? h->second : 0;
+
+        char color[32];
+        std::snprintf(color, sizeof(color), "0.000 %.3f 1.000", static_cast<double>(derived) / hottest);
+
+        dot += "    n" + std::to_string(ids[node]) +
+            " [label=\"" + escape(label) + "\\n" + std::to_string(derived) +
+            "\", fillcolor=\"" + color + "\"];\n";
+    }
+
+    for (const Node* node : nodes)
+    {
+        std::size_t order = 0;
+        node->forEachChild([&](const Node* child)
+        {
+            dot += "    n" + std::to_string(ids[node]) + " -> n" + std::to_string(ids[child]) +
+                " [label=\"" + std::to_string(order++) + "\"];\n";
+        });
+    }
+
+    return dot + "}\n";
+}
+
+// Counts the nodes reachable from lang
+template <typename L>
+std::unordered_set<const typename Trace<L>::Node*> Trace<L>::reachable(const Node* lang)
+{
+    std::unordered_set<const Node*> seen;
+    std::vector<const Node*> pending(1, lang);
+    seen.insert(lang);
+    while (!pending.empty())
+    {
+        const Node* node = pending.back();
+        pending.pop_back();
+        node->forEachChild([&](const Node* child)
+        {
+            if (seen.insert(child).second) pending.push_back(child);
+        });
+    }
+
+    return seen;
+}
+
+template <typename L>
+std::string Trace<L>::escape(const std::string& str)
+{
+    std::string escaped;
+    for (char c : str)
+    {
+        switch (c)
+        {
+            case '"':  escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\\\n"; break;
+            case '\r': escaped += "\\\\r"; break;
+            case '\t': escaped += "\\\\t"; break;
+            default:   escaped += c; break;
+        }
+    }
+
+    return escaped;
+}
+
+} // namespace derp
+
+#endif
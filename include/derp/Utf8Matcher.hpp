@@ -0,0 +1,78 @@
+#ifndef LIB_DERP_UTF8_MATCHER_HPP
+#define LIB_DERP_UTF8_MATCHER_HPP
+
+#include "Language.hpp"
+#include "priv/Utf8.hpp"
+
+#include <string>
+#include <vector>
+
+namespace derp
+{
+
+// Matches UTF-8 text against a language of code points (a Language<char32_t>), so a
+// grammar can say "any Greek letter" as one range rather than as the alternation of
+// every byte sequence encoding one. Inputs are validated before matching, a vector of
+// ASCII at a time, and then decoded as they are derived; an ill-formed input (an
+// overlong form, a surrogate, a truncated sequence) does not match, and error() says
+// where it went wrong.
+template <typename L>
+class Utf8Matcher
+{
+public:
+    typedef typename L::GarbageCollector GarbageCollector;
+
+    Utf8Matcher(const L& language) : gc(language.gc), root(language.l), invalid(std::string::npos) {}
+
+    bool matches(const char* input, std::size_t size);
+
+    bool matches(const std::string& input)
+    {
+        return matches(input.data(), input.size());
+    }
+
+    // The offset of the first byte of the first ill-formed sequence of the last input,
+    // or npos if it was well-formed
+    std::size_t error() const { return invalid; }
+
+private:
+    typedef priv::Language<char32_t> Node;
+
+    GarbageCollector& gc;
+    Node* root;
+    std::size_t invalid;
+
+    priv::Pinned<Node> pinned;
+};
+
+template <typename L>
+bool Utf8Matcher<L>::matches(const char* input, std::size_t size)
+{
+    std::size_t valid = priv::validUtf8(input, input + size);
+    invalid = (valid == size) ? std::string::npos : valid;
+    if (valid != size) return false;
+
+    pinned.pin(gc);
+
+    std::uint64_t counter = ++gc.epoch;
+    Node* lang = root;
+    const char* i = input;
+    const char* end = input + size;
+    while (i != end && lang->type != Node::NULL_LANGUAGE)
+    {
+        char32_t c = priv::decodeUtf8(i);
+        counter = ++gc.epoch;
+        lang = lang->derive(c, counter, gc);
+        gc.collect(priv::IsDead<char32_t>(counter));
+    }
+
+    bool matched = lang->isNullable(counter, gc);
+
+    pinned.unpin(gc);
+
+    return matched;
+}
+
+} // namespace derp
+
+#endif
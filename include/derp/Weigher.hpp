@@ -0,0 +1,569 @@
+#ifndef LIB_DERP_WEIGHER_HPP
+#define LIB_DERP_WEIGHER_HPP
+
+#include "Language.hpp"
+#include "Semiring.hpp"
+#include "priv/GarbageCollector.hpp"
+#include "priv/Weighted.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cassert>
+
+namespace derp
+{
+
+// Weighs the parses of inputs in a semiring S (see Semiring.hpp), such as how many
+// parses there are or what the cheapest one costs, without enumerating them. Every
+// parse weighs the product of the weights of the languages given with weights that it
+// goes through, and an input weighs the sum over its parses.
+//
+// The language is copied into weighted nodes, which are derived and simplified much
+// like Language nodes but keep count of how many ways each word is reached, so the
+// work per token is polynomial however ambiguous the grammar is. Matching stays with
+// Language, which needs none of this. Intersections and complements filter words
+// rather than parse them, so grammars using them cannot be weighed.
+template <typename L, typename S = Counting>
+class Weigher
+{
+public:
+    typedef typename S::Value Value;
+
+    template <typename C = std::vector<std::pair<L, Value>>>
+    explicit Weigher(const L& language, const C& weights = C());
+    ~Weigher();
+
+    Weigher(const Weigher<L, S>&) = delete;
+    Weigher<L, S>& operator= (const Weigher<L, S>&) = delete;
+
+    Value weigh(const char* input, std::size_t size);
+
+    Value weigh(const std::string& input)
+    {
+        return weigh(input.data(), input.size());
+    }
+
+private:
+    typedef priv::Weighted<S> Node;
+    typedef priv::Language<char> Source;
+
+    Node* allocate(typename Node::Type type);
+    Node* convert(const Source* lang, std::unordered_map<const Source*, Node*>& image,
+        const std::unordered_map<const Source*, Value>& weights);
+    Node* unite(const std::vector<Source*>& children, std::size_t begin, std::size_t end,
+        std::unordered_map<const Source*, Node*>& image, const std::unordered_map<const Source*, Value>& weights);
+    Node* chain(const std::vector<Source*>& children, std::size_t begin,
+        std::unordered_map<const Source*, Node*>& image, const std::unordered_map<const Source*, Value>& weights);
+
+    Node* derive(Node* lang, char token, std::uint64_t counter);
+    Node* simplify(Node* lang);
+    Node* resolve(Node* lang);
+    void solve();
+
+    priv::GarbageCollector<Node> gc;
+    std::vector<Node*> grammar;
+    std::vector<Node*> fresh;
+
+    Node* root;
+    Node* zero;
+    Node* one;
+};
+
+template <typename L, typename S>
+template <typename C>
+Weigher<L, S>::Weigher(const L& language, const C& c)
+{
+    std::unordered_map<const Source*, Value> weights;
+    for (const auto& i : c)
+    {
+        weights[i.first.l] = i.second;
+    }
+
+    zero = allocate(Node::ZERO_LANGUAGE);
+    one = allocate(Node::ONE_LANGUAGE);
+
+    std::unordered_map<const Source*, Node*> image;
+    root = simplify(convert(language.l, image, weights));
+
+    for (Node* node : fresh)
+    {
+        node->grammar = true;
+        node->fresh = false;
+    }
+    fresh.clear();
+
+    gc.steal(grammar);
+}
+
+template <typename L, typename S>
+Weigher<L, S>::~Weigher()
+{
+    gc.give(grammar);
+}
+
+template <typename L, typename S>
+typename Weigher<L, S>::Value Weigher<L, S>::weigh(const char* input, std::size_t size)
+{
+    Node* lang = root;
+    std::vector<Node*> pending;
+    for (std::size_t i = 0; i < size && lang != zero; ++i)
+    {
+        std::uint64_t counter = ++gc.epoch;
+        lang = simplify(derive(lang, input[i], counter));
+
+        for (Node* node : fresh)
+        {
+            node->fresh = false;
+        }
+        fresh.clear();
+
+        // Keep what the derivative reaches, which is never the grammar's to collect
+        counter = ++gc.epoch;
+        pending.assign(1, lang);
+        while (!pending.empty())
+        {
+            Node* node = pending.back();
+            pending.pop_back();
+            if (node->grammar || node->marker == counter) continue;
+
+            node->marker = counter;
+            if (node->left != nullptr) pending.push_back(node->left);
+            if (node->right != nullptr) pending.push_back(node->right);
+        }
+
+        gc.collect([counter](const Node* node) { return node->marker != counter; });
+    }
+
+    Value weight = lang->null;
+    gc.collect();
+
+    return weight;
+}
+
+template <typename L, typename S>
+typename Weigher<L, S>::Node* Weigher<L, S>::allocate(typename Node::Type type)
+{
+    Node* node = gc();
+    node->type = type;
+    node->literal.reset();
+    node->offset = 0;
+    node->left = nullptr;
+    node->right = nullptr;
+    node->weight = S::one();
+    node->null = S::zero();
+    node->nonempty = false;
+    node->grammar = false;
+    node->fresh = true;
+    node->marker = 0;
+    node->memoize = nullptr;
+    node->forward = nullptr;
+
+    fresh.push_back(node);
+    return node;
+}
+
+template <typename L, typename S>
+typename Weigher<L, S>::Node* Weigher<L, S>::convert(const Source* lang, std::unordered_map<const Source*, Node*>& image,
+    const std::unordered_map<const Source*, Value>& weights)
+{
+    auto found = image.find(lang);
+    if (found != image.end()) return found->second;
+
+    // Weighted languages stand for a weight node around their copy
+    Node* node = nullptr;
+    Node* stand = nullptr;
+    auto weight = weights.find(lang);
+    if (weight != weights.end())
+    {
+        stand = allocate(Node::WEIGHT_LANGUAGE);
+        stand->weight = weight->second;
+    }
+
+    switch (lang->type)
+    {
+        case Source::NULL_LANGUAGE:     node = zero; break;
+        case Source::EMPTY_LANGUAGE:    node = one; break;
+        case Source::EVENT_LANGUAGE:    node = one; break;
+        case Source::TERMINAL_LANGUAGE:
+            node = allocate(Node::TERMINAL_LANGUAGE);
+            node->t = lang->t;
+            break;
+        case Source::LITERAL_LANGUAGE:
+            node = allocate(Node::LITERAL_LANGUAGE);
+            node->literal = lang->literal;
+            node->offset = lang->offset;
+            break;
+        case Source::RANGE_LANGUAGE:
+            // One terminal per byte; the alternatives are disjoint, so each byte
+            // still has a single parse
+            for (std::size_t b = 0; b < 256; ++b)
+            {
+                if (!lang->inRanges(static_cast<char>(b))) continue;
+
+                Node* terminal = allocate(Node::TERMINAL_LANGUAGE);
+                terminal->t = static_cast<char>(b);
+                if (node == nullptr)
+                {
+                    node = terminal;
+                }
+                else
+                {
+                    Node* alt = allocate(Node::ALTERNATE_LANGUAGE);
+                    alt->left = node;
+                    alt->right = terminal;
+                    node = alt;
+                }
+            }
+            break;
+        case Source::ALTERNATE_LANGUAGE:
+        case Source::SEQUENCE_LANGUAGE:
+        case Source::REPETITION_LANGUAGE:
+        case Source::UNION_LANGUAGE:
+        case Source::CONCATENATION_LANGUAGE:
+            break;
+        case Source::LAZY_LANGUAGE:
+            // Only derivatives are lazy, and grammars are never derivatives
+            assert(false);
+            node = zero;
+            break;
+        case Source::INTERSECTION_LANGUAGE:
+        case Source::COMPLEMENT_LANGUAGE:
+            assert(false);
+            node = zero;
+            break;
+    }
+
+    if (node != nullptr)
+    {
+        if (stand == nullptr) stand = node; else stand->left = node;
+        image.emplace(lang, stand);
+        return stand;
+    }
+
+    // Languages that refer to others stand in before those are converted, as they may
+    // refer back to them
+    switch (lang->type)
+    {
+        case Source::ALTERNATE_LANGUAGE:    node = allocate(Node::ALTERNATE_LANGUAGE); break;
+        case Source::SEQUENCE_LANGUAGE:     node = allocate(Node::SEQUENCE_LANGUAGE); break;
+        case Source::REPETITION_LANGUAGE:   node = allocate(Node::REPETITION_LANGUAGE); break;
+        case Source::UNION_LANGUAGE:        node = allocate(Node::ALTERNATE_LANGUAGE); break;
+        case Source::CONCATENATION_LANGUAGE: node = allocate(Node::SEQUENCE_LANGUAGE); break;
+        default:                            assert(false); break;
+    }
+
+    if (stand == nullptr) stand = node; else stand->left = node;
+    image.emplace(lang, stand);
+
+    switch (lang->type)
+    {
+        case Source::ALTERNATE_LANGUAGE:
+        case Source::SEQUENCE_LANGUAGE:
+            node->left = convert(lang->left, image, weights);
+            node->right = convert(lang->right, image, weights);
+            break;
+        case Source::REPETITION_LANGUAGE:
+            node->left = convert(lang->pattern, image, weights);
+            break;
+        case Source::UNION_LANGUAGE:
+            {
+                std::size_t middle = lang->children.size() / 2;
+                node->left = unite(lang->children, 0, middle, image, weights);
+                node->right = unite(lang->children, middle, lang->children.size(), image, weights);
+                break;
+            }
+        case Source::CONCATENATION_LANGUAGE:
+            if (lang->left != nullptr)
+            {
+                node->left = convert(lang->left, image, weights);
+                node->right = chain(lang->spine->children, lang->offset, image, weights);
+            }
+            else
+            {
+                node->left = convert(lang->spine->children[lang->offset], image, weights);
+                node->right = chain(lang->spine->children, lang->offset + 1, image, weights);
+            }
+            break;
+        default:
+            break;
+    }
+
+    return stand;
+}
+
+// The alternation of children [begin, end), as a balanced tree
+template <typename L, typename S>
+typename Weigher<L, S>::Node* Weigher<L, S>::unite(const std::vector<Source*>& children, std::size_t begin, std::size_t end,
+    std::unordered_map<const Source*, Node*>& image, const std::unordered_map<const Source*, Value>& weights)
+{
+    if (end - begin == 1) return convert(children[begin], image, weights);
+
+    std::size_t middle = begin + (end - begin) / 2;
+    Node* alt = allocate(Node::ALTERNATE_LANGUAGE);
+    alt->left = unite(children, begin, middle, image, weights);
+    alt->right = unite(children, middle, end, image, weights);
+    return alt;
+}
+
+// The sequence of children from begin on
+template <typename L, typename S>
+typename Weigher<L, S>::Node* Weigher<L, S>::chain(const std::vector<Source*>& children, std::size_t begin,
+    std::unordered_map<const Source*, Node*>& image, const std::unordered_map<const Source*, Value>& weights)
+{
+    if (begin == children.size()) return one;
+    if (begin + 1 == children.size()) return convert(children[begin], image, weights);
+
+    Node* seq = allocate(Node::SEQUENCE_LANGUAGE);
+    seq->left = convert(children[begin], image, weights);
+    seq->right = chain(children, begin + 1, image, weights);
+    return seq;
+}
+
+// Derives a simplified language, making fresh nodes that may still need simplifying.
+// Nodes stand in for their derivative before deriving their children, which may refer
+// back to them.
+template <typename L, typename S>
+typename Weigher<L, S>::Node* Weigher<L, S>::derive(Node* lang, char token, std::uint64_t counter)
+{
+    switch (lang->type)
+    {
+        case Node::ZERO_LANGUAGE:
+        case Node::ONE_LANGUAGE:
+            return zero;
+        case Node::TERMINAL_LANGUAGE:
+            return (lang->t == token) ? one : zero;
+        case Node::LITERAL_LANGUAGE:
+            if ((*lang->literal)[lang->offset] != token) return zero;
+            if (lang->offset + 1 == lang->literal->size()) return one;
+            break;
+        default:
+            break;
+    }
+
+    if (lang->marker == counter) return lang->memoize;
+    lang->marker = counter;
+
+    Node* derivative = nullptr;
+    switch (lang->type)
+    {
+        case Node::LITERAL_LANGUAGE:
+            derivative = allocate(Node::LITERAL_LANGUAGE);
+            derivative->literal = lang->literal;
+            derivative->offset = lang->offset + 1;
+            lang->memoize = derivative;
+            break;
+        case Node::ALTERNATE_LANGUAGE:
+            derivative = allocate(Node::ALTERNATE_LANGUAGE);
+            lang->memoize = derivative;
+            derivative->left = derive(lang->left, token, counter);
+            derivative->right = derive(lang->right, token, counter);
+            break;
+        case Node::SEQUENCE_LANGUAGE:
+            {
+                // D(ab) = D(a) b + null(a) D(b)
+                derivative = allocate(Node::ALTERNATE_LANGUAGE);
+                lang->memoize = derivative;
+
+                Node* first = allocate(Node::SEQUENCE_LANGUAGE);
+                first->right = lang->right;
+                derivative->left = first;
+
+                if (lang->left->null == S::zero())
+                {
+                    derivative->right = zero;
+                }
+                else
+                {
+                    Node* second = allocate(Node::WEIGHT_LANGUAGE);
+                    second->weight = lang->left->null;
+                    derivative->right = second;
+                    second->left = derive(lang->right, token, counter);
+                }
+
+                first->left = derive(lang->left, token, counter);
+                break;
+            }
+        case Node::REPETITION_LANGUAGE:
+            // D(a*) = D(a) a*, so that a parse repeats only what consumes input
+            derivative = allocate(Node::SEQUENCE_LANGUAGE);
+            lang->memoize = derivative;
+            derivative->right = lang;
+            derivative->left = derive(lang->left, token, counter);
+            break;
+        case Node::WEIGHT_LANGUAGE:
+            derivative = allocate(Node::WEIGHT_LANGUAGE);
+            derivative->weight = lang->weight;
+            lang->memoize = derivative;
+            derivative->left = derive(lang->left, token, counter);
+            break;
+        default:
+            assert(false);
+            break;
+    }
+
+    return derivative;
+}
+
+// Simplifies the fresh nodes reachable from lang, which is the new root, dropping the
+// languages without words and standing nodes in for the one side of a sequence with
+// the empty word or of an alternation with no words. Then solves for their null weights.
+template <typename L, typename S>
+typename Weigher<L, S>::Node* Weigher<L, S>::simplify(Node* lang)
+{
+    // Whether a language has any word is a least fixed point
+    for (Node* node : fresh)
+    {
+        node->nonempty = false;
+    }
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (std::size_t i = fresh.size(); i-- > 0;)
+        {
+            Node* node = fresh[i];
+            if (node->nonempty) continue;
+
+            switch (node->type)
+            {
+                case Node::ZERO_LANGUAGE:       break;
+                case Node::ONE_LANGUAGE:
+                case Node::TERMINAL_LANGUAGE:
+                case Node::LITERAL_LANGUAGE:
+                case Node::REPETITION_LANGUAGE: node->nonempty = true; break;
+                case Node::ALTERNATE_LANGUAGE:  node->nonempty = node->left->nonempty || node->right->nonempty; break;
+                case Node::SEQUENCE_LANGUAGE:   node->nonempty = node->left->nonempty && node->right->nonempty; break;
+                case Node::WEIGHT_LANGUAGE:     node->nonempty = node->left->nonempty && !(node->weight == S::zero()); break;
+            }
+            if (node->nonempty) changed = true;
+        }
+    }
+
+    for (Node* node : fresh)
+    {
+        resolve(node);
+    }
+
+    for (Node* node : fresh)
+    {
+        if (node->forward != node) continue;
+
+        if (node->left != nullptr) node->left = resolve(node->left);
+        if (node->right != nullptr) node->right = resolve(node->right);
+    }
+
+    lang = resolve(lang);
+    solve();
+
+    return lang;
+}
+
+// Returns the node that stands in for a fresh one. The nodes a node may stand in for
+// have words exactly when it has, so if they go around a cycle, none has words.
+template <typename L, typename S>
+typename Weigher<L, S>::Node* Weigher<L, S>::resolve(Node* lang)
+{
+    if (!lang->fresh) return lang;
+
+    if (lang->forward != nullptr)
+    {
+        // Follow what others stand in for, in case this was resolved around a cycle
+        Node* node = lang->forward;
+        while (node->fresh && node->forward != nullptr && node->forward != node) node = node->forward;
+        lang->forward = node;
+        return node;
+    }
+
+    // Around a cycle, a node stands for itself
+    lang->forward = lang;
+
+    Node* result = lang;
+    if (!lang->nonempty)
+    {
+        result = zero;
+    }
+    else
+    {
+        switch (lang->type)
+        {
+            case Node::ALTERNATE_LANGUAGE:
+                if (!lang->left->nonempty) result = resolve(lang->right);
+                else if (!lang->right->nonempty) result = resolve(lang->left);
+                break;
+            case Node::SEQUENCE_LANGUAGE:
+                {
+                    Node* left = resolve(lang->left);
+                    Node* right = resolve(lang->right);
+                    if (left == one) result = right;
+                    else if (right == one) result = left;
+                    break;
+                }
+            case Node::REPETITION_LANGUAGE:
+                if (!lang->left->nonempty) result = one;
+                break;
+            case Node::WEIGHT_LANGUAGE:
+                if (lang->weight == S::one()) result = resolve(lang->left);
+                break;
+            default:
+                break;
+        }
+    }
+
+    lang->forward = result;
+    return result;
+}
+
+// Solves for the null weights of the fresh nodes that stand for themselves, iterating
+// from zero until nothing changes
+template <typename L, typename S>
+void Weigher<L, S>::solve()
+{
+    std::vector<Node*> nodes;
+    for (Node* node : fresh)
+    {
+        if (node->forward == node) nodes.push_back(node);
+    }
+
+    zero->null = S::zero();
+    one->null = S::one();
+
+    std::size_t limit = S::rounds * (nodes.size() + 1);
+    for (std::size_t round = 0;; ++round)
+    {
+        bool changed = false;
+
+        // Children are mostly made after their parents, so go backwards
+        for (std::size_t i = nodes.size(); i-- > 0;)
+        {
+            Node* node = nodes[i];
+
+            Value null = S::zero();
+            switch (node->type)
+            {
+                case Node::ZERO_LANGUAGE:       null = S::zero(); break;
+                case Node::ONE_LANGUAGE:        null = S::one(); break;
+                case Node::TERMINAL_LANGUAGE:   null = S::zero(); break;
+                case Node::LITERAL_LANGUAGE:    null = S::zero(); break;
+                case Node::REPETITION_LANGUAGE: null = S::one(); break;
+                case Node::ALTERNATE_LANGUAGE:  null = S::plus(node->left->null, node->right->null); break;
+                case Node::SEQUENCE_LANGUAGE:   null = S::times(node->left->null, node->right->null); break;
+                case Node::WEIGHT_LANGUAGE:     null = S::times(node->weight, node->left->null); break;
+            }
+
+            if (!(null == node->null))
+            {
+                node->null = (round < limit) ? null : S::diverge(null);
+                changed = true;
+            }
+        }
+
+        if (!changed) break;
+    }
+}
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef LIB_DERP_PRIV_ALPHABET_HPP
+#define LIB_DERP_PRIV_ALPHABET_HPP
+
+#include "ByteSet.hpp"
+#include "Language.hpp"
+
+#include <cstddef>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace derp
+{
+
+namespace priv
+{
+
+// A partition of the bytes into classes that a grammar cannot tell apart. The bytes of
+// a class are members of exactly the same sets of alternative terminals (and match no
+// terminal on their own), so deriving by any of them gives the same language, and
+// whatever is worked out for one of them holds for the whole class.
+class Alphabet
+{
+public:
+    // Every byte in a class of its own
+    Alphabet();
+
+    // The coarsest partition for the grammar reachable from root
+    explicit Alphabet(const Language<char>* root);
+
+    // The number of classes
+    std::size_t size() const { return count; }
+
+    unsigned char operator[] (char c) const
+    {
+        return classes[static_cast<unsigned char>(c)];
+    }
+
+    // The smallest byte of a class
+    char representative(unsigned char c) const
+    {
+        return representatives[c];
+    }
+
+    // Adds the whole class of c to set
+    void insertClass(ByteSet& set, char c) const;
+
+private:
+    // Splits every class into the bytes in a set and the bytes not in it
+    void refine(const bool (&in)[256]);
+
+    unsigned char classes[256];
+    char representatives[256];
+    std::size_t count;
+};
+
+inline Alphabet::Alphabet() :
+    count(256)
+{
+    for (std::size_t b = 0; b < 256; ++b)
+    {
+        classes[b] = static_cast<unsigned char>(b);
+        representatives[b] = static_cast<char>(b);
+    }
+}
+
+inline Alphabet::Alphabet(const Language<char>* root) :
+    count(1)
+{
+    for (std::size_t b = 0; b < 256; ++b)
+    {
+        classes[b] = 0;
+    }
+
+    std::vector<const Language<char>*> nodes;
+    std::unordered_set<const Language<char>*> seen;
+    seen.insert(root);
+    nodes.push_back(root);
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+        nodes[i]->forEachChild([&](const Language<char>* child)
+        {
+            if (seen.insert(child).second) nodes.push_back(child);
+        });
+    }
+
+    // A set of alternative terminals is an alternation whose branches all are terminals
+    // or such sets, found as the greatest fixed point, as alternations may be cyclic
+    std::unordered_map<const Language<char>*, bool> terminals;
+    for (const Language<char>* node : nodes)
+    {
+        bool candidate = node->type == Language<char>::TERMINAL_LANGUAGE ||
+            node->type == Language<char>::RANGE_LANGUAGE ||
+            node->type == Language<char>::ALTERNATE_LANGUAGE ||
+            node->type == Language<char>::UNION_LANGUAGE;
+        terminals.emplace(node, candidate);
+    }
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (const Language<char>* node : nodes)
+        {
+            bool& set = terminals[node];
+            if (!set || node->type == Language<char>::TERMINAL_LANGUAGE || node->type == Language<char>::RANGE_LANGUAGE) continue;
+
+            node->forEachChild([&](const Language<char>* child)
+            {
+                if (!terminals[child]) set = false;
+            });
+            if (!set) changed = true;
+        }
+    }
+
+    // Refine by the largest sets only, which are the ones something else refers to
+    std::vector<const Language<char>*> sets;
+    std::unordered_set<const Language<char>*> refined;
+    bool in[256];
+    auto split = [&](const Language<char>* node)
+    {
+        if (!refined.insert(node).second) return;
+
+        for (bool& b : in) b = false;
+        sets.assign(1, node);
+        std::unordered_set<const Language<char>*> inside;
+        inside.insert(node);
+        while (!sets.empty())
+        {
+            const Language<char>* set = sets.back();
+            sets.pop_back();
+            if (set->type == Language<char>::TERMINAL_LANGUAGE) in[static_cast<unsigned char>(set->t)] = true;
+            if (set->type == Language<char>::RANGE_LANGUAGE)
+            {
+                for (std::size_t b = 0; b < 256; ++b)
+                {
+                    if (set->inRanges(static_cast<char>(b))) in[b] = true;
+                }
+            }
+            set->forEachChild([&](const Language<char>* child)
+            {
+                if (inside.insert(child).second) sets.push_back(child);
+            });
+        }
+
+        refine(in);
+    };
+    auto single = [&](char c)
+    {
+        for (bool& b : in) b = false;
+        in[static_cast<unsigned char>(c)] = true;
+        refine(in);
+    };
+
+    if (terminals[root]) split(root);
+    for (const Language<char>* node : nodes)
+    {
+        if (terminals[node]) continue;
+
+        switch (node->type)
+        {
+            case Language<char>::LAZY_LANGUAGE:
+                // A pending derivative tells its token apart from the others
+                single(node->t);
+                break;
+            case Language<char>::LITERAL_LANGUAGE:
+                for (char c : *node->literal)
+                {
+                    single(c);
+                }
+                break;
+            default:
+                break;
+        }
+
+        node->forEachChild([&](const Language<char>* child)
+        {
+            if (terminals[child]) split(child);
+        });
+    }
+
+    for (std::size_t b = 256; b-- > 0;)
+    {
+        representatives[classes[b]] = static_cast<char>(b);
+    }
+}
+
+inline void Alphabet::insertClass(ByteSet& set, char c) const
+{
+    unsigned char k = (*this)[c];
+    for (std::size_t b = 0; b < 256; ++b)
+    {
+        if (classes[b] == k) set.insert(static_cast<char>(b));
+    }
+}
+
+inline void Alphabet::refine(const bool (&in)[256])
+{
+    // The class that the members of the set split off each class into, once there is one
+    unsigned char split[256];
+    bool splitting[256] = {};
+    bool outside[256] = {};
+
+    for (std::size_t b = 0; b < 256; ++b)
+    {
+        if (!in[b]) outside[classes[b]] = true;
+    }
+
+    for (std::size_t b = 0; b < 256; ++b)
+    {
+        unsigned char k = classes[b];
+        if (!in[b] || !outside[k]) continue;
+
+        // Only classes with bytes on both sides split
+        if (!splitting[k])
+        {
+            splitting[k] = true;
+            split[k] = static_cast<unsigned char>(count);
+            ++count;
+        }
+        classes[b] = split[k];
+    }
+}
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef LIB_DERP_PRIV_BUDGET_ALLOCATOR_HPP
+#define LIB_DERP_PRIV_BUDGET_ALLOCATOR_HPP
+
+#include "Language.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <limits>
+
+namespace derp
+{
+
+namespace priv
+{
+
+// Forwards allocations to a garbage collector, counting the nodes derivations visit
+// (memo hits included). Once a derivation takes the visits up to maxVisits, or runs past
+// the deadline, it is aborted, and so is every derivation after it.
+template <typename T, typename A>
+struct BudgetAllocator
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // The clock is only read every this many visits, as reading it costs more than one
+    static const std::size_t CLOCK_INTERVAL = 64;
+
+    BudgetAllocator(A& gc) :
+        gc(gc), visits(0), maxVisits(std::numeric_limits<std::size_t>::max()), deadline(Clock::time_point::max()),
+        aborted(false)
+    {
+    }
+
+    A& gc;
+    std::size_t visits;
+    std::size_t maxVisits;
+    Clock::time_point deadline;
+    bool aborted;
+
+    Language<T>* operator() ()
+    {
+        return gc();
+    }
+};
+
+template <typename T, typename A>
+inline void onDerive(BudgetAllocator<T, A>& allocate, const Language<T>*)
+{
+    ++allocate.visits;
+}
+
+template <typename T, typename A>
+inline bool shouldAbort(BudgetAllocator<T, A>& allocate, const Language<T>*)
+{
+    if (allocate.aborted) return true;
+
+    if (allocate.visits >= allocate.maxVisits)
+    {
+        allocate.aborted = true;
+    }
+    else if (allocate.visits % BudgetAllocator<T, A>::CLOCK_INTERVAL == 0 &&
+             allocate.deadline != BudgetAllocator<T, A>::Clock::time_point::max())
+    {
+        allocate.aborted = BudgetAllocator<T, A>::Clock::now() >= allocate.deadline;
+    }
+
+    return allocate.aborted;
+}
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef LIB_DERP_PRIV_BYTESET_HPP
+#define LIB_DERP_PRIV_BYTESET_HPP
+
+#include "Simd.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace derp
+{
+
+namespace priv
+{
+
+// A set of bytes that can find the end of a run of its members quickly
+class ByteSet
+{
+public:
+    ByteSet()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (std::uint64_t& word : bits) word = 0;
+        count = 0;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    bool contains(char c) const
+    {
+        unsigned char b = static_cast<unsigned char>(c);
+        return (bits[b >> 6] >> (b & 63)) & 1;
+    }
+
+    void insert(char c)
+    {
+        if (contains(c)) return;
+
+        unsigned char b = static_cast<unsigned char>(c);
+        bits[b >> 6] |= std::uint64_t(1) << (b & 63);
+        if (count < sizeof(members)) members[count] = c;
+        ++count;
+    }
+
+    // Returns a pointer to the first byte in [begin, end) that is not in the set
+    const char* skip(const char* begin, const char* end) const;
+
+private:
+    // Few enough members to compare against each of them in a vector register
+    static const std::size_t VECTOR_MEMBERS = 8;
+
+    std::uint64_t bits[4];
+    char members[VECTOR_MEMBERS];
+    std::size_t count;
+};
+
+inline const char* ByteSet::skip(const char* begin, const char* end) const
+{
+    const char* i = begin;
+
+    if (count <= VECTOR_MEMBERS)
+    {
+#if defined(LIB_DERP_AVX2)
+        __m256i splat[VECTOR_MEMBERS];
+        for (std::size_t m = 0; m < count; ++m) splat[m] = _mm256_set1_epi8(members[m]);
+
+        for (; end - i >= 32; i += 32)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(i));
+            __m256i in = _mm256_setzero_si256();
+            for (std::size_t m = 0; m < count; ++m) in = _mm256_or_si256(in, _mm256_cmpeq_epi8(block, splat[m]));
+
+            std::uint32_t out = ~static_cast<std::uint32_t>(_mm256_movemask_epi8(in));
+            if (out != 0) return i + lowestBit(out);
+        }
+#elif defined(LIB_DERP_SSE2)
+        __m128i splat[VECTOR_MEMBERS];
+        for (std::size_t m = 0; m < count; ++m) splat[m] = _mm_set1_epi8(members[m]);
+
+        for (; end - i >= 16; i += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(i));
+            __m128i in = _mm_setzero_si128();
+            for (std::size_t m = 0; m < count; ++m) in = _mm_or_si128(in, _mm_cmpeq_epi8(block, splat[m]));
+
+            std::uint32_t out = ~static_cast<std::uint32_t>(_mm_movemask_epi8(in)) & 0xFFFF;
+            if (out != 0) return i + lowestBit(out);
+        }
+#endif
+    }
+
+    // Scalar fallback, also used for the tail and for large sets
+    while (i != end && contains(*i)) ++i;
+    return i;
+}
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
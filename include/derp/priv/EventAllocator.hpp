@@ -0,0 +1,184 @@
+#ifndef LIB_DERP_PRIV_EVENT_ALLOCATOR_HPP
+#define LIB_DERP_PRIV_EVENT_ALLOCATOR_HPP
+
+#include "Language.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace derp
+{
+
+namespace priv
+{
+
+// Forwards allocations to a garbage collector, and keeps the events of the null parses
+// that derivatives skip over, recording the offset of the token being derived
+template <typename T, typename A>
+struct EventAllocator
+{
+    EventAllocator(A& gc) : gc(gc), offset(0) {}
+
+    A& gc;
+    std::size_t offset;
+
+    // The null parse events of each node, for the current counter only
+    std::unordered_map<const Language<T>*, Language<T>*> nulled;
+
+    Language<T>* operator() ()
+    {
+        return gc();
+    }
+
+    Language<T>* nullParse(Language<T>* lang, std::uint64_t counter);
+
+private:
+    Language<T>* either(Language<T>* lang, Language<T>* left, Language<T>* right, std::uint64_t counter);
+    Language<T>* both(Language<T>* lang, Language<T>* left, Language<T>* right, std::uint64_t counter);
+};
+
+// Returns a language of the events recorded by the null parses of lang, which is &null
+// if lang is not nullable and &empty if no null parse records any. Events that were
+// recorded already (by earlier tokens) are kept as they are.
+template <typename T, typename A>
+Language<T>* EventAllocator<T, A>::nullParse(Language<T>* lang, std::uint64_t counter)
+{
+    if (!lang->isNullable(counter, *this)) return &Language<T>::null;
+
+    switch (lang->type)
+    {
+        case Language<T>::LAZY_LANGUAGE:
+            return nullParse(lang->force(counter, *this), counter);
+        case Language<T>::EVENT_LANGUAGE:
+            if (lang->offset != std::string::npos)
+            {
+                lang->mark(counter);
+                return lang;
+            }
+            break;
+        case Language<T>::ALTERNATE_LANGUAGE:
+        case Language<T>::SEQUENCE_LANGUAGE:
+        case Language<T>::UNION_LANGUAGE:
+        case Language<T>::CONCATENATION_LANGUAGE:
+        case Language<T>::INTERSECTION_LANGUAGE:
+            break;
+        default:
+            // Null parses of a repetition repeat nothing
+            return &Language<T>::empty;
+    }
+
+    auto found = nulled.find(lang);
+    if (found != nulled.end()) return found->second;
+
+    if (lang->type == Language<T>::EVENT_LANGUAGE)
+    {
+        Language<T>* evt = gc();
+        evt->marker = counter;
+        evt->memoize = nullptr;
+        evt->type = Language<T>::EVENT_LANGUAGE;
+        evt->event = lang->event;
+        evt->offset = offset;
+        nulled.emplace(lang, evt);
+        return evt;
+    }
+
+    // Null parses that go around a cycle record nothing the acyclic ones do not
+    nulled.emplace(lang, &Language<T>::empty);
+
+    Language<T>* result = &Language<T>::null;
+    switch (lang->type)
+    {
+        case Language<T>::ALTERNATE_LANGUAGE:
+            result = either(lang, nullParse(lang->left, counter), nullParse(lang->right, counter), counter);
+            break;
+        case Language<T>::SEQUENCE_LANGUAGE:
+            result = both(lang, nullParse(lang->left, counter), nullParse(lang->right, counter), counter);
+            break;
+        case Language<T>::INTERSECTION_LANGUAGE:
+            // The left operand is the one parsed; the right only filters its parses
+            result = nullParse(lang->left, counter);
+            break;
+        case Language<T>::UNION_LANGUAGE:
+            for (Language<T>* child : lang->children)
+            {
+                result = either(nullptr, result, nullParse(child, counter), counter);
+            }
+            break;
+        case Language<T>::CONCATENATION_LANGUAGE:
+            result = (lang->left != nullptr) ? nullParse(lang->left, counter) : &Language<T>::empty;
+            for (std::size_t i = lang->offset; i < lang->spine->children.size(); ++i)
+            {
+                result = both(nullptr, result, nullParse(lang->spine->children[i], counter), counter);
+            }
+            break;
+        default:
+            break;
+    }
+
+    nulled[lang] = result;
+    return result;
+}
+
+// The events of either of two null parses. A node made of events only is kept as it is.
+template <typename T, typename A>
+Language<T>* EventAllocator<T, A>::either(Language<T>* lang, Language<T>* left, Language<T>* right, std::uint64_t counter)
+{
+    if (left->type == Language<T>::NULL_LANGUAGE) return right;
+    if (right->type == Language<T>::NULL_LANGUAGE) return left;
+    if (left == right) return left;
+
+    if (lang != nullptr && left == lang->left && right == lang->right)
+    {
+        lang->mark(counter);
+        return lang;
+    }
+
+    Language<T>* alt = gc();
+    alt->marker = counter;
+    alt->memoize = nullptr;
+    alt->leastFixedPointFound = true;
+    alt->nullable = true;
+    alt->type = Language<T>::ALTERNATE_LANGUAGE;
+    alt->left = left;
+    alt->right = right;
+    return alt;
+}
+
+// The events of one null parse followed by those of another
+template <typename T, typename A>
+Language<T>* EventAllocator<T, A>::both(Language<T>* lang, Language<T>* left, Language<T>* right, std::uint64_t counter)
+{
+    if (left->type == Language<T>::NULL_LANGUAGE || right->type == Language<T>::NULL_LANGUAGE) return &Language<T>::null;
+    if (left->type == Language<T>::EMPTY_LANGUAGE) return right;
+    if (right->type == Language<T>::EMPTY_LANGUAGE) return left;
+
+    if (lang != nullptr && left == lang->left && right == lang->right)
+    {
+        lang->mark(counter);
+        return lang;
+    }
+
+    Language<T>* seq = gc();
+    seq->marker = counter;
+    seq->memoize = nullptr;
+    seq->leastFixedPointFound = true;
+    seq->nullable = true;
+    seq->type = Language<T>::SEQUENCE_LANGUAGE;
+    seq->left = left;
+    seq->right = right;
+    return seq;
+}
+
+template <typename T, typename A>
+inline Language<T>* nullEvents(EventAllocator<T, A>& allocate, Language<T>* lang, std::uint64_t counter)
+{
+    return allocate.nullParse(lang, counter);
+}
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef LIB_DERP_PRIV_GARBAGE_COLLECTOR_HPP
 #define LIB_DERP_PRIV_GARBAGE_COLLECTOR_HPP
 
+#include <cstdint>
 #include <vector>
 
 namespace derp
@@ -21,6 +22,10 @@ struct GarbageCollector
     std::vector<T*> alive;
     std::vector<T*> dead;
 
+    // The last counter handed out for deriving nodes of this collector. Counters only
+    // grow, so nodes never need resetting between matches.
+    std::uint64_t epoch = 0;
+
     ~GarbageCollector()
     {
         for (T* t : alive)
@@ -53,6 +58,26 @@ struct GarbageCollector
         }
     }
 
+    // Moves the nodes that select picks from alive into container, out of reach of
+    // collection until they are given back or released
+    template <typename C, typename P>
+    void steal(C& container, P select)
+    {
+        for (std::size_t i = 0; i < alive.size();)
+        {
+            if (select(alive[i]))
+            {
+                container.push_back(alive[i]);
+                alive[i] = alive.back();
+                alive.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
     template <typename C>
     void give(C& container)
     {
@@ -60,7 +85,6 @@ struct GarbageCollector
         container.clear();
     }
 
-    template <typename C>
     void give(std::vector<T*>& container)
     {
         if (alive.empty())
@@ -91,6 +115,25 @@ struct GarbageCollector
         }
     }
 
+    // Frees the nodes in container (stolen earlier) that isDead picks
+    template <typename P>
+    void release(std::vector<T*>& container, P isDead)
+    {
+        for (std::size_t i = 0; i < container.size();)
+        {
+            if (isDead(container[i]))
+            {
+                dead.push_back(container[i]);
+                container[i] = container.back();
+                container.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
     void collect()
     {
         if (dead.empty())
@@ -135,6 +178,34 @@ struct GarbageCollector
     }
 };
 
+// The nodes a collector held when a match began (the grammar among them, and whatever
+// other handles refer to), kept out of reach while the match collects its own garbage.
+// pin() steals them; unpin() collects what the match left behind and gives them back.
+// Stealing into an empty vector is a swap, so matchers keep a Pinned between matches to
+// reuse one buffer rather than allocate for every match.
+template <typename T>
+class Pinned
+{
+public:
+    template <typename A>
+    void pin(A& gc)
+    {
+        gc.steal(held);
+    }
+
+    template <typename A>
+    void unpin(A& gc)
+    {
+        gc.collect();
+        gc.give(held);
+    }
+
+    const std::vector<T*>& nodes() const { return held; }
+
+private:
+    std::vector<T*> held;
+};
+
 } // namespace priv
 
 } // namespace derp
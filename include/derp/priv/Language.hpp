@@ -1,7 +1,17 @@
 #ifndef LIB_DERP_PRIV_LANGUAGE_HPP
 #define LIB_DERP_PRIV_LANGUAGE_HPP
 
+#include "Utf8.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <cassert>
 
@@ -11,6 +21,28 @@ namespace derp
 namespace priv
 {
 
+template <typename T>
+struct Language;
+
+// The children of a concatenation. Derivatives of the concatenation keep referring
+// to the suffix they have yet to match, so the derivative of each suffix is memoized
+// here and computed at most once per token, however many nodes share it. Children are
+// always grammar nodes.
+template <typename T>
+struct Spine
+{
+    std::vector<Language<T>*> children;
+    std::vector<Language<T>*> memoize;
+    std::vector<std::uint64_t> marker;
+
+    void push_back(Language<T>* child)
+    {
+        children.push_back(child);
+        memoize.push_back(nullptr);
+        marker.push_back(0);
+    }
+};
+
 // Tokes are of type T
 template <typename T>
 struct Language
@@ -23,7 +55,14 @@ struct Language
         TERMINAL_LANGUAGE,
         ALTERNATE_LANGUAGE,
         SEQUENCE_LANGUAGE,
-        REPETITION_LANGUAGE
+        REPETITION_LANGUAGE,
+        UNION_LANGUAGE,
+        CONCATENATION_LANGUAGE,
+        LITERAL_LANGUAGE,
+        EVENT_LANGUAGE,
+        RANGE_LANGUAGE,
+        INTERSECTION_LANGUAGE,
+        COMPLEMENT_LANGUAGE
     };
 
     Language() = default;
@@ -37,8 +76,9 @@ struct Language
     Language(Type type) : type(type) {}
 
     // The marker is for preventing infinite recursion and for marking which
-    // objects were used in the current iteration (for the garbage collector)
-    unsigned int marker;
+    // objects were used in the current iteration (for the garbage collector).
+    // Counters are never reused, so a memo is stale once the marker falls behind.
+    std::uint64_t marker;
 
     // The type of the language
     Type type;
@@ -46,36 +86,82 @@ struct Language
     // For TERMINAL and LAZY
     T t; // terminal
 
-    // For ALTERNATE and SEQUENCE
+    // For ALTERNATE, SEQUENCE and INTERSECTION (left is also the optional head of
+    // CONCATENATION)
     Language<T>* left;
     Language<T>* right;
 
-    // For REPETITION and LAZY
+    // For REPETITION, COMPLEMENT and LAZY
     Language<T>* pattern;
 
-    // For ALTERNATE and SEQUENCE
+    // For UNION
+    std::vector<Language<T>*> children;
+
+    // For CONCATENATION, and LAZY with no pattern: the spine's children from offset on
+    std::shared_ptr<Spine<T>> spine;
+    std::size_t offset;
+
+    // For LITERAL: the tokens of the literal from offset on (always at least one)
+    std::shared_ptr<const std::basic_string<T>> literal;
+
+    // For RANGE: the inclusive ranges of tokens it matches, sorted, and neither
+    // overlapping nor adjacent (so there are at least two, or a range of two tokens)
+    std::shared_ptr<const std::vector<std::pair<T, T>>> ranges;
+
+    // For EVENT: twice the index of the named language, plus one for where it ends. In
+    // the grammar, offset is npos; derivatives record where in the input it happened.
+    std::size_t event;
+
+    // For ALTERNATE, SEQUENCE, UNION, and CONCATENATION
     bool leastFixedPointFound;
     bool nullable;
 
-    // For ALTERNATE, SEQUENCE, and REPETITION
+    // For ALTERNATE, SEQUENCE, UNION, and CONCATENATION in the grammar: set while
+    // only a temporary refers to the node, so that it may be extended in place
+    bool anonymous = false;
+
+    // For ALTERNATE, SEQUENCE, REPETITION, UNION, CONCATENATION, and LITERAL
     Language<T>* memoize;
 
     // Helper functions
-    std::string toString(unsigned int counter);
+    std::string toString(std::uint64_t counter);
     template <typename C>
-    std::string toString(unsigned int counter, const C& c, bool skipLookup = false);
+    std::string toString(std::uint64_t counter, const C& c, bool skipLookup = false);
     template <typename F>
-    void explore(unsigned int counter, F callback);
+    void explore(std::uint64_t counter, F callback);
+    template <typename F>
+    void forEachChild(F callback) const;
+    bool equivalent(const Language<T>* other, unsigned int& budget) const;
+    bool inRanges(T token) const;
 
     // Important functions
     template <typename A>
-    bool isNullable(unsigned int counter, A& allocate);
+    bool isNullable(std::uint64_t counter, A& allocate);
+    bool unsolved() const;
+    bool nullableFromChildren() const;
+    template <typename A>
+    void solveNullable(std::uint64_t counter, A& allocate);
+    template <typename A>
+    Language<T>* derive(T token, std::uint64_t counter, A& allocate);
+    template <typename A>
+    Language<T>* derivative(T token, std::uint64_t counter, A& allocate);
     template <typename A>
-    Language<T>* derive(T token, unsigned int counter, A& allocate);
+    Language<T>* defer(T token, std::uint64_t counter, A& allocate);
     template <typename A>
-    Language<T>* force(unsigned int counter, A& allocate);
-    void mark(unsigned int counter);
+    Language<T>* force(std::uint64_t counter, A& allocate);
+    template <typename A>
+    static Language<T>* deriveSuffix(const std::shared_ptr<Spine<T>>& spine, std::size_t offset, T token, std::uint64_t counter, A& allocate);
+    template <typename A>
+    static Language<T>* deferSuffix(const std::shared_ptr<Spine<T>>& spine, std::size_t offset, T token, std::uint64_t counter, A& allocate);
+    void mark(std::uint64_t counter);
+    void become(Language<T>* optimal);
+    void remark(std::uint64_t from, std::uint64_t to);
+    Language<T>* leadingLiteral();
+    template <typename A>
+    Language<T>* advanceLiteral(std::size_t count, std::uint64_t counter, A& allocate);
     Language<T>* compact();
+    bool flattensInto(const Language<T>* parent) const;
+    std::tuple<const void*, std::size_t, const void*> key() const;
 
     static Language<T> null;
     static Language<T> empty;
@@ -87,6 +173,63 @@ Language<T> Language<T>::null(Language<T>::NULL_LANGUAGE);
 template <typename T>
 Language<T> Language<T>::empty(Language<T>::EMPTY_LANGUAGE);
 
+// Called for every derivation and for every derivative found in a memo. They do nothing
+// by default; an allocator can overload them (found by argument-dependent lookup) to
+// observe the derivation.
+template <typename A, typename T>
+inline void onDerive(A&, const Language<T>*)
+{
+}
+
+template <typename A, typename T>
+inline void onMemoHit(A&, const Language<T>*)
+{
+}
+
+// Called when the derivation of a language returns, after onDerive() and everything
+// derived on the way
+template <typename A, typename T>
+inline void onDerived(A&, const Language<T>*)
+{
+}
+
+// Whether to give up deriving, checked before every derivation. Once it says so, every
+// derivation returns the null language straight away, so the derivative as a whole is
+// wrong and must be thrown away. Never by default; an allocator can overload it (found
+// by argument-dependent lookup) to bound the work of a derivation.
+template <typename A, typename T>
+inline bool shouldAbort(A&, const Language<T>*)
+{
+    return false;
+}
+
+// Returns the events that the null parses of a nullable language record, as a language
+// of events that matches only the empty string. There are none unless an allocator
+// overloads it (found by argument-dependent lookup) to track events.
+template <typename A, typename T>
+inline Language<T>* nullEvents(A&, Language<T>*, std::uint64_t)
+{
+    return &Language<T>::empty;
+}
+
+// When a derivative skips over a nullable language, the events of its null parses
+// precede the rest of the derivative
+template <typename T, typename A>
+Language<T>* afterNull(Language<T>* skipped, Language<T>* rest, std::uint64_t counter, A& allocate)
+{
+    Language<T>* events = nullEvents(allocate, skipped, counter);
+    if (events->type == Language<T>::EMPTY_LANGUAGE || rest->type == Language<T>::NULL_LANGUAGE) return rest;
+
+    Language<T>* seq = allocate();
+    seq->marker = counter;
+    seq->memoize = nullptr;
+    seq->leastFixedPointFound = false;
+    seq->type = Language<T>::SEQUENCE_LANGUAGE;
+    seq->left = events;
+    seq->right = rest;
+    return seq;
+}
+
 template <typename T>
 bool Language<T>::operator== (const Language<T>& other) const
 {
@@ -96,13 +239,19 @@ bool Language<T>::operator== (const Language<T>& other) const
         left == other.left &&
         right == other.right &&
         pattern == other.pattern &&
+        children == other.children &&
+        spine == other.spine &&
+        offset == other.offset &&
+        literal == other.literal &&
+        ranges == other.ranges &&
+        event == other.event &&
         leastFixedPointFound == other.leastFixedPointFound &&
         nullable == other.nullable &&
         memoize == other.memoize;
 }
 
 template <typename T>
-std::string Language<T>::toString(unsigned int counter)
+std::string Language<T>::toString(std::uint64_t counter)
 {
     if (marker == counter)
     {
@@ -111,6 +260,9 @@ std::string Language<T>::toString(unsigned int counter)
             case Language<T>::NULL_LANGUAGE:     break;
             case Language<T>::EMPTY_LANGUAGE:    break;
             case Language<T>::TERMINAL_LANGUAGE: break;
+            case Language<T>::LITERAL_LANGUAGE:  break;
+            case Language<T>::EVENT_LANGUAGE:    break;
+            case Language<T>::RANGE_LANGUAGE:    break;
             default:                             return "\u221E"; // Infinity symbol
         }
     }
@@ -119,19 +271,43 @@ std::string Language<T>::toString(unsigned int counter)
 
     switch (type)
     {
-        case Language<T>::LAZY_LANGUAGE:       return "D_" + std::string(1, t) + "(" + pattern->toString(counter) + ")";
+        case Language<T>::LAZY_LANGUAGE:       return "D_" + text(t) + "(" + ((pattern != nullptr) ? pattern->toString(counter) : "...") + ")";
         case Language<T>::NULL_LANGUAGE:       return "\u2205";
         case Language<T>::EMPTY_LANGUAGE:      return "\u025B";
-        case Language<T>::TERMINAL_LANGUAGE:   return "'" + std::string(1, t) + "'";
+        case Language<T>::TERMINAL_LANGUAGE:   return "'" + text(t) + "'";
         case Language<T>::ALTERNATE_LANGUAGE:  return "(" + left->toString(counter) + " | " + right->toString(counter) + ")";
         case Language<T>::SEQUENCE_LANGUAGE:   return left->toString(counter) + " " + right->toString(counter);
         case Language<T>::REPETITION_LANGUAGE: return "(" + pattern->toString(counter) + ")*";
+        case Language<T>::INTERSECTION_LANGUAGE: return "(" + left->toString(counter) + " && " + right->toString(counter) + ")";
+        case Language<T>::COMPLEMENT_LANGUAGE: return "!(" + pattern->toString(counter) + ")";
+        case Language<T>::LITERAL_LANGUAGE:    return "\"" + text(literal->data() + offset, literal->data() + literal->size()) + "\"";
+        case Language<T>::EVENT_LANGUAGE:      return (event & 1) ? std::to_string(event >> 1) + "}" : "{" + std::to_string(event >> 1);
+        case Language<T>::RANGE_LANGUAGE:      return text(*ranges);
+        case Language<T>::UNION_LANGUAGE:
+            {
+                std::string str = "(" + children[0]->toString(counter);
+                for (std::size_t i = 1; i < children.size(); ++i)
+                {
+                    str += " | " + children[i]->toString(counter);
+                }
+                return str + ")";
+            }
+        case Language<T>::CONCATENATION_LANGUAGE:
+            {
+                std::string str = (left != nullptr) ? left->toString(counter) + " " : "";
+                str += spine->children[offset]->toString(counter);
+                for (std::size_t i = offset + 1; i < spine->children.size(); ++i)
+                {
+                    str += " " + spine->children[i]->toString(counter);
+                }
+                return str;
+            }
     }
 }
 
 template <typename T>
 template <typename C>
-std::string Language<T>::toString(unsigned int counter, const C& c, bool skipLookup)
+std::string Language<T>::toString(std::uint64_t counter, const C& c, bool skipLookup)
 {
     if (!skipLookup)
     {
@@ -146,6 +322,9 @@ std::string Language<T>::toString(unsigned int counter, const C& c, bool skipLoo
             case Language<T>::NULL_LANGUAGE:     break;
             case Language<T>::EMPTY_LANGUAGE:    break;
             case Language<T>::TERMINAL_LANGUAGE: break;
+            case Language<T>::LITERAL_LANGUAGE:  break;
+            case Language<T>::EVENT_LANGUAGE:    break;
+            case Language<T>::RANGE_LANGUAGE:    break;
             default:                             return "\u221E"; // Infinity symbol
         }
     }
@@ -154,19 +333,43 @@ std::string Language<T>::toString(unsigned int counter, const C& c, bool skipLoo
 
     switch (type)
     {
-        case Language<T>::LAZY_LANGUAGE:       return "D_" + std::string(1, t) + "(" + pattern->toString(counter, c) + ")";
+        case Language<T>::LAZY_LANGUAGE:       return "D_" + text(t) + "(" + ((pattern != nullptr) ? pattern->toString(counter, c) : "...") + ")";
         case Language<T>::NULL_LANGUAGE:       return "\u2205";
         case Language<T>::EMPTY_LANGUAGE:      return "\u025B";
-        case Language<T>::TERMINAL_LANGUAGE:   return "'" + std::string(1, t) + "'";
+        case Language<T>::TERMINAL_LANGUAGE:   return "'" + text(t) + "'";
         case Language<T>::ALTERNATE_LANGUAGE:  return "(" + left->toString(counter, c) + " | " + right->toString(counter, c) + ")";
         case Language<T>::SEQUENCE_LANGUAGE:   return left->toString(counter, c) + " " + right->toString(counter, c);
         case Language<T>::REPETITION_LANGUAGE: return "(" + pattern->toString(counter, c) + ")*";
+        case Language<T>::INTERSECTION_LANGUAGE: return "(" + left->toString(counter, c) + " && " + right->toString(counter, c) + ")";
+        case Language<T>::COMPLEMENT_LANGUAGE: return "!(" + pattern->toString(counter, c) + ")";
+        case Language<T>::LITERAL_LANGUAGE:    return "\"" + text(literal->data() + offset, literal->data() + literal->size()) + "\"";
+        case Language<T>::EVENT_LANGUAGE:      return (event & 1) ? std::to_string(event >> 1) + "}" : "{" + std::to_string(event >> 1);
+        case Language<T>::RANGE_LANGUAGE:      return text(*ranges);
+        case Language<T>::UNION_LANGUAGE:
+            {
+                std::string str = "(" + children[0]->toString(counter, c);
+                for (std::size_t i = 1; i < children.size(); ++i)
+                {
+                    str += " | " + children[i]->toString(counter, c);
+                }
+                return str + ")";
+            }
+        case Language<T>::CONCATENATION_LANGUAGE:
+            {
+                std::string str = (left != nullptr) ? left->toString(counter, c) + " " : "";
+                str += spine->children[offset]->toString(counter, c);
+                for (std::size_t i = offset + 1; i < spine->children.size(); ++i)
+                {
+                    str += " " + spine->children[i]->toString(counter, c);
+                }
+                return str;
+            }
     }
 }
 
 template <typename T>
 template <typename F>
-void Language<T>::explore(unsigned int counter, F callback)
+void Language<T>::explore(std::uint64_t counter, F callback)
 {
     if (marker == counter) return;
 
@@ -176,19 +379,150 @@ void Language<T>::explore(unsigned int counter, F callback)
 
     switch (type)
     {
-        case Language<T>::LAZY_LANGUAGE:       pattern->explore(counter, callback); return;
+        case Language<T>::LAZY_LANGUAGE:       if (pattern != nullptr) pattern->explore(counter, callback); return;
         case Language<T>::NULL_LANGUAGE:       return;
         case Language<T>::EMPTY_LANGUAGE:      return;
         case Language<T>::TERMINAL_LANGUAGE:   return;
         case Language<T>::ALTERNATE_LANGUAGE:  left->explore(counter, callback); right->explore(counter, callback); return;
         case Language<T>::SEQUENCE_LANGUAGE:   left->explore(counter, callback); right->explore(counter, callback); return;
         case Language<T>::REPETITION_LANGUAGE: pattern->explore(counter, callback); return;
+        case Language<T>::INTERSECTION_LANGUAGE: left->explore(counter, callback); right->explore(counter, callback); return;
+        case Language<T>::COMPLEMENT_LANGUAGE: pattern->explore(counter, callback); return;
+        case Language<T>::LITERAL_LANGUAGE:    return;
+        case Language<T>::EVENT_LANGUAGE:      return;
+        case Language<T>::RANGE_LANGUAGE:      return;
+        case Language<T>::UNION_LANGUAGE:
+            for (Language<T>* child : children)
+            {
+                child->explore(counter, callback);
+            }
+            return;
+        case Language<T>::CONCATENATION_LANGUAGE:
+            if (left != nullptr) left->explore(counter, callback);
+            for (std::size_t i = offset; i < spine->children.size(); ++i)
+            {
+                spine->children[i]->explore(counter, callback);
+            }
+            return;
+    }
+}
+
+// Visits the direct children, leaving markers untouched
+template <typename T>
+template <typename F>
+void Language<T>::forEachChild(F callback) const
+{
+    switch (type)
+    {
+        case Language<T>::LAZY_LANGUAGE:       if (pattern != nullptr) callback(static_cast<const Language<T>*>(pattern)); return;
+        case Language<T>::NULL_LANGUAGE:       return;
+        case Language<T>::EMPTY_LANGUAGE:      return;
+        case Language<T>::TERMINAL_LANGUAGE:   return;
+        case Language<T>::ALTERNATE_LANGUAGE:  callback(static_cast<const Language<T>*>(left)); callback(static_cast<const Language<T>*>(right)); return;
+        case Language<T>::SEQUENCE_LANGUAGE:   callback(static_cast<const Language<T>*>(left)); callback(static_cast<const Language<T>*>(right)); return;
+        case Language<T>::REPETITION_LANGUAGE: callback(static_cast<const Language<T>*>(pattern)); return;
+        case Language<T>::INTERSECTION_LANGUAGE: callback(static_cast<const Language<T>*>(left)); callback(static_cast<const Language<T>*>(right)); return;
+        case Language<T>::COMPLEMENT_LANGUAGE: callback(static_cast<const Language<T>*>(pattern)); return;
+        case Language<T>::LITERAL_LANGUAGE:    return;
+        case Language<T>::EVENT_LANGUAGE:      return;
+        case Language<T>::RANGE_LANGUAGE:      return;
+        case Language<T>::UNION_LANGUAGE:
+            for (const Language<T>* child : children)
+            {
+                callback(child);
+            }
+            return;
+        case Language<T>::CONCATENATION_LANGUAGE:
+            if (left != nullptr) callback(static_cast<const Language<T>*>(left));
+            for (std::size_t i = offset; i < spine->children.size(); ++i)
+            {
+                callback(static_cast<const Language<T>*>(spine->children[i]));
+            }
+            return;
+    }
+}
+
+// Conservatively checks whether two derivatives denote the same language by comparing
+// their structure; budget bounds the work, as derivatives may be cyclic
+template <typename T>
+bool Language<T>::equivalent(const Language<T>* other, unsigned int& budget) const
+{
+    if (this == other) return true;
+    if (type != other->type || budget == 0) return false;
+    --budget;
+
+    switch (type)
+    {
+        case Language<T>::LAZY_LANGUAGE:       return false;
+        case Language<T>::NULL_LANGUAGE:       return true;
+        case Language<T>::EMPTY_LANGUAGE:      return true;
+        case Language<T>::TERMINAL_LANGUAGE:   return t == other->t;
+        case Language<T>::ALTERNATE_LANGUAGE:  return left->equivalent(other->left, budget) && right->equivalent(other->right, budget);
+        case Language<T>::SEQUENCE_LANGUAGE:   return left->equivalent(other->left, budget) && right->equivalent(other->right, budget);
+        case Language<T>::REPETITION_LANGUAGE: return pattern->equivalent(other->pattern, budget);
+        case Language<T>::INTERSECTION_LANGUAGE: return left->equivalent(other->left, budget) && right->equivalent(other->right, budget);
+        case Language<T>::COMPLEMENT_LANGUAGE: return pattern->equivalent(other->pattern, budget);
+        case Language<T>::LITERAL_LANGUAGE:    return literal == other->literal && offset == other->offset;
+        case Language<T>::EVENT_LANGUAGE:      return event == other->event && offset == other->offset;
+        case Language<T>::RANGE_LANGUAGE:      return ranges == other->ranges;
+        case Language<T>::UNION_LANGUAGE:
+            {
+                // Children may be in another order, as derivatives merge alternatives
+                if (children.size() != other->children.size()) return false;
+                for (const Language<T>* child : children)
+                {
+                    bool found = false;
+                    for (const Language<T>* match : other->children)
+                    {
+                        if (child->equivalent(match, budget))
+                        {
+                            found = true;
+                            break;
+                        }
+                    }
+                    if (!found) return false;
+                }
+                for (const Language<T>* match : other->children)
+                {
+                    bool found = false;
+                    for (const Language<T>* child : children)
+                    {
+                        if (match->equivalent(child, budget))
+                        {
+                            found = true;
+                            break;
+                        }
+                    }
+                    if (!found) return false;
+                }
+                return true;
+            }
+        case Language<T>::CONCATENATION_LANGUAGE:
+            {
+                if (spine != other->spine || offset != other->offset) return false;
+                if (left == nullptr || other->left == nullptr) return left == other->left;
+                return left->equivalent(other->left, budget);
+            }
     }
+
+    return false;
+}
+
+// Whether a RANGE matches token, by binary search
+template <typename T>
+bool Language<T>::inRanges(T token) const
+{
+    auto i = std::upper_bound(ranges->begin(), ranges->end(), token, [](T t, const std::pair<T, T>& range)
+    {
+        return t < range.first;
+    });
+
+    return i != ranges->begin() && token <= (i - 1)->second;
 }
 
 template <typename T>
 template <typename A>
-bool Language<T>::isNullable(unsigned int counter, A& allocate)
+bool Language<T>::isNullable(std::uint64_t counter, A& allocate)
 {
     switch (type)
     {
@@ -196,69 +530,248 @@ bool Language<T>::isNullable(unsigned int counter, A& allocate)
         case Language<T>::NULL_LANGUAGE:       return false;
         case Language<T>::EMPTY_LANGUAGE:      return true;
         case Language<T>::TERMINAL_LANGUAGE:   return false;
-        case Language<T>::ALTERNATE_LANGUAGE:
+        case Language<T>::REPETITION_LANGUAGE: return true;
+        case Language<T>::LITERAL_LANGUAGE:    return false;
+        case Language<T>::EVENT_LANGUAGE:      return true;
+        case Language<T>::RANGE_LANGUAGE:      return false;
+        case Language<T>::COMPLEMENT_LANGUAGE:
             {
-                if (leastFixedPointFound) return nullable;
-
-                leastFixedPointFound = true;
-                nullable = false;
-                bool back = left->isNullable(counter, allocate) || right->isNullable(counter, allocate);
-                nullable = back;
-
-                while ((left->isNullable(counter, allocate) || right->isNullable(counter, allocate)) != back)
+                // Nullability is not monotonic through a complement, so its pattern is
+                // solved on its own. A complement that its pattern refers back to has no
+                // meaning; the cycle is cut by taking it to be not nullable meanwhile.
+                if (!leastFixedPointFound)
                 {
-                    back = left->isNullable(counter, allocate) || right->isNullable(counter, allocate);
-                    nullable = back;
+                    leastFixedPointFound = true;
+                    nullable = false;
+                    nullable = !pattern->isNullable(counter, allocate);
                 }
 
-                return back;
+                return nullable;
             }
+        case Language<T>::ALTERNATE_LANGUAGE:
         case Language<T>::SEQUENCE_LANGUAGE:
+        case Language<T>::UNION_LANGUAGE:
+        case Language<T>::CONCATENATION_LANGUAGE:
+        case Language<T>::INTERSECTION_LANGUAGE:
             {
                 if (leastFixedPointFound) return nullable;
 
-                leastFixedPointFound = true;
-                nullable = false;
-                bool back = left->isNullable(counter, allocate) && right->isNullable(counter, allocate);
-                nullable = back;
+                // Most nodes only depend on nodes that are already solved
+                bool solved = true;
+                forEachChild([&](const Language<T>* child)
+                {
+                    if (child->unsolved()) solved = false;
+                });
 
-                while ((left->isNullable(counter, allocate) && right->isNullable(counter, allocate)) != back)
+                if (solved)
                 {
-                    back = left->isNullable(counter, allocate) && right->isNullable(counter, allocate);
-                    nullable = back;
+                    nullable = nullableFromChildren();
+                    leastFixedPointFound = true;
+                }
+                else
+                {
+                    solveNullable(counter, allocate);
                 }
 
-                return back;
-
+                return nullable;
             }
-        case Language<T>::REPETITION_LANGUAGE: return true;
     }
 
     assert(false);
     return false;
 }
 
+// Whether nullability is not yet known for this node
+template <typename T>
+bool Language<T>::unsolved() const
+{
+    switch (type)
+    {
+        case Language<T>::LAZY_LANGUAGE:          return true;
+        case Language<T>::ALTERNATE_LANGUAGE:     return !leastFixedPointFound;
+        case Language<T>::SEQUENCE_LANGUAGE:      return !leastFixedPointFound;
+        case Language<T>::UNION_LANGUAGE:         return !leastFixedPointFound;
+        case Language<T>::CONCATENATION_LANGUAGE: return !leastFixedPointFound;
+        case Language<T>::INTERSECTION_LANGUAGE:  return !leastFixedPointFound;
+        case Language<T>::COMPLEMENT_LANGUAGE:    return !leastFixedPointFound;
+        default:                                  return false;
+    }
+}
+
+// Nullability from the children's current (possibly tentative) nullability
+template <typename T>
+bool Language<T>::nullableFromChildren() const
+{
+    auto nullableNow = [](const Language<T>* lang)
+    {
+        switch (lang->type)
+        {
+            case Language<T>::EMPTY_LANGUAGE:      return true;
+            case Language<T>::REPETITION_LANGUAGE: return true;
+            case Language<T>::EVENT_LANGUAGE:      return true;
+            case Language<T>::ALTERNATE_LANGUAGE:
+            case Language<T>::SEQUENCE_LANGUAGE:
+            case Language<T>::UNION_LANGUAGE:
+            case Language<T>::CONCATENATION_LANGUAGE:
+            case Language<T>::INTERSECTION_LANGUAGE:
+            case Language<T>::COMPLEMENT_LANGUAGE:
+                return lang->nullable;
+            default:
+                return false;
+        }
+    };
+
+    switch (type)
+    {
+        case Language<T>::ALTERNATE_LANGUAGE: return nullableNow(left) || nullableNow(right);
+        case Language<T>::SEQUENCE_LANGUAGE:  return nullableNow(left) && nullableNow(right);
+        case Language<T>::INTERSECTION_LANGUAGE: return nullableNow(left) && nullableNow(right);
+        case Language<T>::UNION_LANGUAGE:
+            for (const Language<T>* child : children)
+            {
+                if (nullableNow(child)) return true;
+            }
+            return false;
+        case Language<T>::CONCATENATION_LANGUAGE:
+            if (left != nullptr && !nullableNow(left)) return false;
+            for (std::size_t i = offset; i < spine->children.size(); ++i)
+            {
+                if (!nullableNow(spine->children[i])) return false;
+            }
+            return true;
+        default:
+            assert(false);
+            return false;
+    }
+}
+
+// Finds the least fixed point of nullability for all unsolved nodes reachable from
+// this one at once. Every node starts out not nullable, and a node that becomes
+// nullable re-examines only the nodes that depend on it. Nullability never reverts,
+// so each node changes at most once and the work is linear in the size of the graph.
+template <typename T>
+template <typename A>
+void Language<T>::solveNullable(std::uint64_t counter, A& allocate)
+{
+    std::unordered_map<const Language<T>*, std::size_t> index;
+    std::vector<Language<T>*> nodes;
+    std::vector<std::vector<std::size_t>> dependents;
+
+    index.emplace(this, 0);
+    nodes.push_back(this);
+    dependents.emplace_back();
+    nullable = false;
+
+    // Discover the unsolved nodes and who depends on each of them
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+        Language<T>* lang = nodes[i];
+        auto depend = [&](Language<T>*& child)
+        {
+            if (child->type == Language<T>::LAZY_LANGUAGE) child = child->force(counter, allocate);
+            if (child->type == Language<T>::COMPLEMENT_LANGUAGE) child->isNullable(counter, allocate);
+            if (!child->unsolved()) return;
+
+            auto found = index.emplace(child, nodes.size());
+            if (found.second)
+            {
+                nodes.push_back(child);
+                dependents.emplace_back();
+                child->nullable = false;
+            }
+            dependents[found.first->second].push_back(i);
+        };
+
+        switch (lang->type)
+        {
+            case Language<T>::ALTERNATE_LANGUAGE:
+            case Language<T>::SEQUENCE_LANGUAGE:
+            case Language<T>::INTERSECTION_LANGUAGE:
+                depend(lang->left);
+                depend(lang->right);
+                break;
+            case Language<T>::UNION_LANGUAGE:
+                for (std::size_t c = 0; c < lang->children.size(); ++c)
+                {
+                    depend(lang->children[c]);
+                }
+                break;
+            case Language<T>::CONCATENATION_LANGUAGE:
+                if (lang->left != nullptr) depend(lang->left);
+                for (std::size_t c = lang->offset; c < lang->spine->children.size(); ++c)
+                {
+                    depend(lang->spine->children[c]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    std::vector<std::size_t> work;
+    work.reserve(nodes.size());
+    for (std::size_t i = nodes.size(); i-- > 0;)
+    {
+        work.push_back(i);
+    }
+
+    while (!work.empty())
+    {
+        std::size_t i = work.back();
+        work.pop_back();
+
+        Language<T>* lang = nodes[i];
+        if (lang->nullable || lang->leastFixedPointFound || !lang->nullableFromChildren()) continue;
+
+        lang->nullable = true;
+        work.insert(work.end(), dependents[i].begin(), dependents[i].end());
+    }
+
+    for (Language<T>* lang : nodes)
+    {
+        lang->leastFixedPointFound = true;
+    }
+}
+
 template <typename T>
 template <typename A>
-Language<T>* Language<T>::derive(T token, unsigned int counter, A& allocate)
+Language<T>* Language<T>::derive(T token, std::uint64_t counter, A& allocate)
 {
-    if (marker != counter)
+    // The null and empty languages are shared by every collector, which may be on other
+    // threads, so they are never written to
+    if (marker != counter && this != &null && this != &empty)
     {
         marker = counter;
         memoize = nullptr;
     }
 
+    if (shouldAbort(allocate, this)) return &null;
+
+    onDerive(allocate, this);
+    Language<T>* result = derivative(token, counter, allocate);
+    onDerived(allocate, this);
+
+    return result;
+}
+
+template <typename T>
+template <typename A>
+Language<T>* Language<T>::derivative(T token, std::uint64_t counter, A& allocate)
+{
     switch (type)
     {
         case Language<T>::LAZY_LANGUAGE:      return force(counter, allocate)->derive(token, counter, allocate);
         case Language<T>::NULL_LANGUAGE:      return &null;
         case Language<T>::EMPTY_LANGUAGE:     return &null;
         case Language<T>::TERMINAL_LANGUAGE:  return (t == token) ? &empty : &null;
+        case Language<T>::EVENT_LANGUAGE:     return &null;
+        case Language<T>::RANGE_LANGUAGE:     return inRanges(token) ? &empty : &null;
         case Language<T>::ALTERNATE_LANGUAGE:
             {
                 Language<T>* result;
                 if (memoize != nullptr)
                 {
+                    onMemoHit(allocate, this);
                     result = memoize;
                 }
                 else
@@ -269,17 +782,8 @@ Language<T>* Language<T>::derive(T token, unsigned int counter, A& allocate)
                     alt->leastFixedPointFound = false;
                     alt->type = Language<T>::ALTERNATE_LANGUAGE;
 
-                    alt->left = allocate();
-                    alt->left->marker = counter;
-                    alt->left->type = Language<T>::LAZY_LANGUAGE;
-                    alt->left->t = token;
-                    alt->left->pattern = left;
-
-                    alt->right = allocate();
-                    alt->right->marker = counter;
-                    alt->right->type = Language<T>::LAZY_LANGUAGE;
-                    alt->right->t = token;
-                    alt->right->pattern = right;
+                    alt->left = left->defer(token, counter, allocate);
+                    alt->right = right->defer(token, counter, allocate);
 
                     memoize = alt;
 
@@ -289,6 +793,63 @@ Language<T>* Language<T>::derive(T token, unsigned int counter, A& allocate)
                     result = memoize = alt->compact();
                 }
 
+                return result;
+            }
+        case Language<T>::INTERSECTION_LANGUAGE:
+            {
+                Language<T>* result;
+                if (memoize != nullptr)
+                {
+                    onMemoHit(allocate, this);
+                    result = memoize;
+                }
+                else
+                {
+                    Language<T>* both = allocate();
+                    both->marker = counter;
+                    both->memoize = nullptr;
+                    both->leastFixedPointFound = false;
+                    both->type = Language<T>::INTERSECTION_LANGUAGE;
+
+                    both->left = left->defer(token, counter, allocate);
+                    both->right = right->defer(token, counter, allocate);
+
+                    memoize = both;
+
+                    // Once one side is null, the other is not worth deriving
+                    both->left = both->left->force(counter, allocate);
+                    if (both->left->type != Language<T>::NULL_LANGUAGE) both->right = both->right->force(counter, allocate);
+
+                    result = memoize = both->compact();
+                }
+
+                return result;
+            }
+        case Language<T>::COMPLEMENT_LANGUAGE:
+            {
+                Language<T>* result;
+                if (memoize != nullptr)
+                {
+                    onMemoHit(allocate, this);
+                    result = memoize;
+                }
+                else
+                {
+                    Language<T>* comp = allocate();
+                    comp->marker = counter;
+                    comp->memoize = nullptr;
+                    comp->leastFixedPointFound = false;
+                    comp->type = Language<T>::COMPLEMENT_LANGUAGE;
+
+                    comp->pattern = pattern->defer(token, counter, allocate);
+
+                    memoize = comp;
+
+                    comp->pattern = comp->pattern->force(counter, allocate);
+
+                    result = memoize = comp->compact();
+                }
+
                 return result;
             }
         case Language<T>::SEQUENCE_LANGUAGE:
@@ -296,6 +857,7 @@ Language<T>* Language<T>::derive(T token, unsigned int counter, A& allocate)
                 Language<T>* result;
                 if (memoize != nullptr)
                 {
+                    onMemoHit(allocate, this);
                     result = memoize;
                 }
                 else
@@ -306,11 +868,7 @@ Language<T>* Language<T>::derive(T token, unsigned int counter, A& allocate)
                     seq->leastFixedPointFound = false;
                     seq->type = Language<T>::SEQUENCE_LANGUAGE;
 
-                    seq->left = allocate();
-                    seq->left->marker = counter;
-                    seq->left->type = Language<T>::LAZY_LANGUAGE;
-                    seq->left->t = token;
-                    seq->left->pattern = left;
+                    seq->left = left->defer(token, counter, allocate);
 
                     seq->right = right;
                     right->mark(counter);
@@ -323,18 +881,14 @@ Language<T>* Language<T>::derive(T token, unsigned int counter, A& allocate)
                         alt->leastFixedPointFound = false;
                         alt->type = Language<T>::ALTERNATE_LANGUAGE;
 
-                        alt->left = allocate();
-                        alt->left->marker = counter;
-                        alt->left->type = Language<T>::LAZY_LANGUAGE;
-                        alt->left->t = token;
-                        alt->left->pattern = right;
+                        alt->left = right->defer(token, counter, allocate);
 
                         alt->right = seq;
 
                         memoize = alt;
 
                         seq->left = seq->left->force(counter, allocate);
-                        alt->left = alt->left->force(counter, allocate);
+                        alt->left = afterNull(left, alt->left->force(counter, allocate), counter, allocate);
 
                         alt->right = seq->compact();
 
@@ -357,6 +911,7 @@ Language<T>* Language<T>::derive(T token, unsigned int counter, A& allocate)
                 Language<T>* result;
                 if (memoize != nullptr)
                 {
+                    onMemoHit(allocate, this);
                     result = memoize;
                 }
                 else
@@ -367,11 +922,7 @@ Language<T>* Language<T>::derive(T token, unsigned int counter, A& allocate)
                     seq->leastFixedPointFound = false;
                     seq->type = Language<T>::SEQUENCE_LANGUAGE;
 
-                    seq->left = allocate();
-                    seq->left->marker = counter;
-                    seq->left->type = Language<T>::LAZY_LANGUAGE;
-                    seq->left->t = token;
-                    seq->left->pattern = pattern;
+                    seq->left = pattern->defer(token, counter, allocate);
 
                     seq->right = this;
 
@@ -384,42 +935,402 @@ Language<T>* Language<T>::derive(T token, unsigned int counter, A& allocate)
 
                 return result;
             }
-    }
+        case Language<T>::UNION_LANGUAGE:
+            {
+                Language<T>* result;
+                if (memoize != nullptr)
+                {
+                    onMemoHit(allocate, this);
+                    result = memoize;
+                }
+                else
+                {
+                    Language<T>* uni = allocate();
+                    uni->marker = counter;
+                    uni->memoize = nullptr;
+                    uni->leastFixedPointFound = false;
+                    uni->type = Language<T>::UNION_LANGUAGE;
+                    uni->children.clear();
+                    for (Language<T>* child : children)
+                    {
+                        uni->children.push_back(child->defer(token, counter, allocate));
+                    }
 
-    assert(false);
-    return nullptr;
-}
+                    memoize = uni;
 
-template <typename T>
-template <typename A>
-Language<T>* Language<T>::force(unsigned int counter, A& allocate)
-{
-    if (type != Language<T>::LAZY_LANGUAGE) return this;
+                    for (std::size_t i = 0; i < uni->children.size(); ++i)
+                    {
+                        uni->children[i] = uni->children[i]->force(counter, allocate);
+                    }
 
-    Language<T>* optimal = pattern->force(counter, allocate)->derive(t, counter, allocate);
-    *this = *optimal;
+                    result = memoize = uni->compact();
+                }
 
-    return optimal;
-}
+                return result;
+            }
+        case Language<T>::CONCATENATION_LANGUAGE:
+            {
+                Language<T>* result;
+                if (memoize != nullptr)
+                {
+                    onMemoHit(allocate, this);
+                    result = memoize;
+                }
+                else if (left == nullptr)
+                {
+                    // Without a head, this is just a suffix of the spine
+                    result = memoize = deriveSuffix(spine, offset, token, counter, allocate);
+                }
+                else
+                {
+                    Language<T>* cat = allocate();
+                    cat->marker = counter;
+                    cat->memoize = nullptr;
+                    cat->leastFixedPointFound = false;
+                    cat->type = Language<T>::CONCATENATION_LANGUAGE;
+                    cat->left = left->defer(token, counter, allocate);
+                    cat->spine = spine;
+                    cat->offset = offset;
+
+                    if (left->isNullable(counter, allocate))
+                    {
+                        Language<T>* alt = allocate();
+                        alt->marker = counter;
+                        alt->memoize = nullptr;
+                        alt->leastFixedPointFound = false;
+                        alt->type = Language<T>::ALTERNATE_LANGUAGE;
+                        alt->left = deferSuffix(spine, offset, token, counter, allocate);
+                        alt->right = cat;
+
+                        memoize = alt;
+
+                        cat->left = cat->left->force(counter, allocate);
+                        alt->left = afterNull(left, alt->left->force(counter, allocate), counter, allocate);
+
+                        alt->right = cat->compact();
+
+                        result = memoize = alt->compact();
+                    }
+                    else
+                    {
+                        memoize = cat;
+
+                        cat->left = cat->left->force(counter, allocate);
+
+                        result = memoize = cat->compact();
+                    }
+                }
+
+                return result;
+            }
+        case Language<T>::LITERAL_LANGUAGE:
+            {
+                if ((*literal)[offset] != token) return &null;
+                if (offset + 1 == literal->size()) return &empty;
+
+                // Only the position moves; the tokens are shared
+                if (memoize != nullptr)
+                {
+                    onMemoHit(allocate, this);
+                }
+                else
+                {
+                    Language<T>* lit = allocate();
+                    lit->marker = counter;
+                    lit->memoize = nullptr;
+                    lit->type = Language<T>::LITERAL_LANGUAGE;
+                    lit->literal = literal;
+                    lit->offset = offset + 1;
+                    memoize = lit;
+                }
+
+                return memoize;
+            }
+    }
+
+    assert(false);
+    return nullptr;
+}
 
 template <typename T>
-void Language<T>::mark(unsigned int counter)
+template <typename A>
+Language<T>* Language<T>::deriveSuffix(const std::shared_ptr<Spine<T>>& spine, std::size_t offset, T token, std::uint64_t counter, A& allocate)
 {
-    if (marker == counter) return;
+    Spine<T>& s = *spine;
+    Language<T>* child = s.children[offset];
+    if (offset + 1 == s.children.size()) return child->derive(token, counter, allocate);
+
+    if (s.marker[offset] == counter && s.memoize[offset] != nullptr)
+    {
+        onMemoHit(allocate, child);
+        return s.memoize[offset];
+    }
+    s.marker[offset] = counter;
+
+    // D(c0 c1 ... cn) = D(c0) c1 ... cn | D(c1 ... cn), where the second term is only
+    // present if c0 is nullable
+    Language<T>* cat = allocate();
+    cat->marker = counter;
+    cat->memoize = nullptr;
+    cat->leastFixedPointFound = false;
+    cat->type = Language<T>::CONCATENATION_LANGUAGE;
+    cat->left = child->defer(token, counter, allocate);
+    cat->spine = spine;
+    cat->offset = offset + 1;
+
+    Language<T>* result;
+    if (child->isNullable(counter, allocate))
+    {
+        Language<T>* alt = allocate();
+        alt->marker = counter;
+        alt->memoize = nullptr;
+        alt->leastFixedPointFound = false;
+        alt->type = Language<T>::ALTERNATE_LANGUAGE;
+        alt->left = deferSuffix(spine, offset + 1, token, counter, allocate);
+        alt->right = cat;
+
+        s.memoize[offset] = alt;
+
+        cat->left = cat->left->force(counter, allocate);
+        alt->left = afterNull(child, alt->left->force(counter, allocate), counter, allocate);
+
+        alt->right = cat->compact();
+
+        result = s.memoize[offset] = alt->compact();
+    }
+    else
+    {
+        s.memoize[offset] = cat;
+
+        cat->left = cat->left->force(counter, allocate);
+
+        result = s.memoize[offset] = cat->compact();
+    }
+
+    return result;
+}
+
+template <typename T>
+template <typename A>
+Language<T>* Language<T>::deferSuffix(const std::shared_ptr<Spine<T>>& spine, std::size_t offset, T token, std::uint64_t counter, A& allocate)
+{
+    Spine<T>& s = *spine;
+    Language<T>* child = s.children[offset];
+    if (offset + 1 == s.children.size()) return child->defer(token, counter, allocate);
+
+    if (s.marker[offset] == counter && s.memoize[offset] != nullptr)
+    {
+        onMemoHit(allocate, child);
+        return s.memoize[offset];
+    }
+
+    Language<T>* lazy = allocate();
+    lazy->marker = counter;
+    lazy->leastFixedPointFound = false;
+    lazy->type = Language<T>::LAZY_LANGUAGE;
+    lazy->t = token;
+    lazy->pattern = nullptr;
+    lazy->spine = spine;
+    lazy->offset = offset;
+    return lazy;
+}
+
+template <typename T>
+template <typename A>
+Language<T>* Language<T>::defer(T token, std::uint64_t counter, A& allocate)
+{
+    // A placeholder is only needed where deriving could lead back to a derivative still
+    // being built. Leaves never recurse, and a derivative already taken is just reused
+    switch (type)
+    {
+        case Language<T>::NULL_LANGUAGE:
+        case Language<T>::EMPTY_LANGUAGE:
+        case Language<T>::TERMINAL_LANGUAGE:
+        case Language<T>::RANGE_LANGUAGE:
+        case Language<T>::EVENT_LANGUAGE:
+        case Language<T>::LITERAL_LANGUAGE:
+            return derive(token, counter, allocate);
+        case Language<T>::LAZY_LANGUAGE:
+            break;
+        default:
+            if (marker == counter && memoize != nullptr)
+            {
+                onMemoHit(allocate, this);
+                return memoize;
+            }
+            break;
+    }
+
+    Language<T>* lazy = allocate();
+    lazy->marker = counter;
+    lazy->leastFixedPointFound = false;
+    lazy->type = Language<T>::LAZY_LANGUAGE;
+    lazy->t = token;
+    lazy->pattern = this;
+    return lazy;
+}
+
+template <typename T>
+template <typename A>
+Language<T>* Language<T>::force(std::uint64_t counter, A& allocate)
+{
+    if (type != Language<T>::LAZY_LANGUAGE) return this;
+
+    Language<T>* optimal;
+    if (pattern != nullptr)
+    {
+        optimal = pattern->force(counter, allocate)->derive(t, counter, allocate);
+    }
+    else
+    {
+        std::shared_ptr<Spine<T>> suffix = spine;
+        optimal = deriveSuffix(suffix, offset, t, counter, allocate);
+    }
+    become(optimal);
+
+    return optimal;
+}
+
+// Turns this node into a copy of an equivalent one, keeping its own marker. The null
+// and empty languages are shared by every collector (which may be on other threads),
+// so they are never written to.
+template <typename T>
+void Language<T>::become(Language<T>* optimal)
+{
+    std::uint64_t counter = marker;
+    if (optimal != &null && optimal != &empty) optimal->marker = counter;
+    *this = *optimal;
+    marker = counter;
+}
+
+template <typename T>
+void Language<T>::mark(std::uint64_t counter)
+{
+    if (marker == counter || this == &null || this == &empty) return;
 
     marker = counter;
     memoize = nullptr;
 
     switch (type)
     {
-        case Language<T>::LAZY_LANGUAGE:       pattern->mark(counter); return;
+        case Language<T>::LAZY_LANGUAGE:       if (pattern != nullptr) pattern->mark(counter); return;
         case Language<T>::NULL_LANGUAGE:       return;
         case Language<T>::EMPTY_LANGUAGE:      return;
         case Language<T>::TERMINAL_LANGUAGE:   return;
         case Language<T>::ALTERNATE_LANGUAGE:  left->mark(counter); right->mark(counter); return;
         case Language<T>::SEQUENCE_LANGUAGE:   left->mark(counter); right->mark(counter); return;
         case Language<T>::REPETITION_LANGUAGE: pattern->mark(counter); return;
+        case Language<T>::INTERSECTION_LANGUAGE: left->mark(counter); right->mark(counter); return;
+        case Language<T>::COMPLEMENT_LANGUAGE: pattern->mark(counter); return;
+        case Language<T>::LITERAL_LANGUAGE:    return;
+        case Language<T>::EVENT_LANGUAGE:      return;
+        case Language<T>::RANGE_LANGUAGE:      return;
+        case Language<T>::UNION_LANGUAGE:
+            for (Language<T>* child : children)
+            {
+                child->mark(counter);
+            }
+            return;
+        case Language<T>::CONCATENATION_LANGUAGE:
+            // The spine only holds grammar nodes, which are never collected
+            if (left != nullptr) left->mark(counter);
+            return;
+    }
+}
+
+// Moves the nodes reachable from this one through nodes marked with from over to to.
+// Only nodes used by the derivation that marked them with from are visited.
+template <typename T>
+void Language<T>::remark(std::uint64_t from, std::uint64_t to)
+{
+    if (marker != from) return;
+
+    marker = to;
+
+    switch (type)
+    {
+        case Language<T>::LAZY_LANGUAGE:       if (pattern != nullptr) pattern->remark(from, to); return;
+        case Language<T>::NULL_LANGUAGE:       return;
+        case Language<T>::EMPTY_LANGUAGE:      return;
+        case Language<T>::TERMINAL_LANGUAGE:   return;
+        case Language<T>::ALTERNATE_LANGUAGE:  left->remark(from, to); right->remark(from, to); return;
+        case Language<T>::SEQUENCE_LANGUAGE:   left->remark(from, to); right->remark(from, to); return;
+        case Language<T>::REPETITION_LANGUAGE: pattern->remark(from, to); return;
+        case Language<T>::INTERSECTION_LANGUAGE: left->remark(from, to); right->remark(from, to); return;
+        case Language<T>::COMPLEMENT_LANGUAGE: pattern->remark(from, to); return;
+        case Language<T>::LITERAL_LANGUAGE:    return;
+        case Language<T>::EVENT_LANGUAGE:      return;
+        case Language<T>::RANGE_LANGUAGE:      return;
+        case Language<T>::UNION_LANGUAGE:
+            for (Language<T>* child : children)
+            {
+                child->remark(from, to);
+            }
+            return;
+        case Language<T>::CONCATENATION_LANGUAGE:
+            if (left != nullptr) left->remark(from, to);
+            return;
+    }
+}
+
+// Returns the literal this language must match next, if any: a literal, or the head
+// of a sequence whose head leads to one (a literal is never nullable, so neither is
+// any such head). Left recursion can make heads cyclic, so the search is bounded.
+template <typename T>
+Language<T>* Language<T>::leadingLiteral()
+{
+    Language<T>* lang = this;
+    for (unsigned int depth = 0; depth < 64; ++depth)
+    {
+        switch (lang->type)
+        {
+            case Language<T>::LITERAL_LANGUAGE:       return lang;
+            case Language<T>::SEQUENCE_LANGUAGE:      lang = lang->left; break;
+            case Language<T>::CONCATENATION_LANGUAGE: if (lang->left == nullptr) return nullptr; lang = lang->left; break;
+            default:                                  return nullptr;
+        }
+    }
+
+    return nullptr;
+}
+
+// The derivative with respect to the next count tokens of the leading literal, which
+// must leave at least one of them unmatched
+template <typename T>
+template <typename A>
+Language<T>* Language<T>::advanceLiteral(std::size_t count, std::uint64_t counter, A& allocate)
+{
+    Language<T>* lang = allocate();
+    lang->marker = counter;
+    lang->memoize = nullptr;
+    lang->type = type;
+
+    switch (type)
+    {
+        case Language<T>::LITERAL_LANGUAGE:
+            assert(offset + count < literal->size());
+            lang->literal = literal;
+            lang->offset = offset + count;
+            break;
+        case Language<T>::SEQUENCE_LANGUAGE:
+            lang->leastFixedPointFound = true;
+            lang->nullable = false;
+            lang->left = left->advanceLiteral(count, counter, allocate);
+            lang->right = right;
+            right->mark(counter);
+            break;
+        case Language<T>::CONCATENATION_LANGUAGE:
+            lang->leastFixedPointFound = true;
+            lang->nullable = false;
+            lang->left = left->advanceLiteral(count, counter, allocate);
+            lang->spine = spine;
+            lang->offset = offset;
+            break;
+        default:
+            assert(false);
     }
+
+    return lang;
 }
 
 template <typename T>
@@ -433,20 +1344,21 @@ Language<T>* Language<T>::compact()
         case Language<T>::NULL_LANGUAGE:      return &null;
         case Language<T>::EMPTY_LANGUAGE:     return &empty;
         case Language<T>::TERMINAL_LANGUAGE:  return this;
+        case Language<T>::LITERAL_LANGUAGE:   return this;
+        case Language<T>::EVENT_LANGUAGE:     return this;
+        case Language<T>::RANGE_LANGUAGE:     return this;
         case Language<T>::ALTERNATE_LANGUAGE:
             {
                 if (left->type == Language<T>::NULL_LANGUAGE)
                 {
                     optimal = right;
-                    optimal->marker = marker; // This should be unnecessary, unless optimal is &null or &empty
-                    *this = *optimal;
+                    become(optimal);
                     return optimal;
                 }
                 else if (right->type == Language<T>::NULL_LANGUAGE)
                 {
                     optimal = left;
-                    optimal->marker = marker; // This should be unnecessary, unless optimal is &null or &empty
-                    *this = *optimal;
+                    become(optimal);
                     return optimal;
                 }
 
@@ -465,11 +1377,20 @@ Language<T>* Language<T>::compact()
                 if (left == right)
                 {
                     optimal = left;
-                    optimal->marker = marker; // This should be unnecessary, unless optimal is &null or &empty
-                    *this = *optimal;
+                    become(optimal);
                     return optimal;
                 }
 
+                if (left->flattensInto(this) || right->flattensInto(this))
+                {
+                    // Become a union so nested alternatives are flattened into this node
+                    type = Language<T>::UNION_LANGUAGE;
+                    children.clear();
+                    children.push_back(left);
+                    children.push_back(right);
+                    return compact();
+                }
+
                 return this;
             }
         case Language<T>::SEQUENCE_LANGUAGE:
@@ -478,22 +1399,50 @@ Language<T>* Language<T>::compact()
                     right->type == Language<T>::NULL_LANGUAGE)
                 {
                     optimal = &null;
-                    optimal->marker = marker; // This should be unnecessary, unless optimal is &null or &empty
-                    *this = null;
+                    become(optimal);
                     return optimal;
                 }
                 else if (left->type == Language<T>::EMPTY_LANGUAGE)
                 {
                     optimal = right;
-                    optimal->marker = marker; // This should be unnecessary, unless optimal is &null or &empty
-                    *this = *optimal;
+                    become(optimal);
                     return optimal;
                 }
                 else if (right->type == Language<T>::EMPTY_LANGUAGE)
                 {
                     optimal = left;
-                    optimal->marker = marker; // This should be unnecessary, unless optimal is &null or &empty
-                    *this = *optimal;
+                    become(optimal);
+                    return optimal;
+                }
+
+                return this;
+            }
+        case Language<T>::INTERSECTION_LANGUAGE:
+            {
+                if (left->type == Language<T>::NULL_LANGUAGE ||
+                    right->type == Language<T>::NULL_LANGUAGE)
+                {
+                    optimal = &null;
+                    become(optimal);
+                    return optimal;
+                }
+
+                if (left == right)
+                {
+                    optimal = left;
+                    become(optimal);
+                    return optimal;
+                }
+
+                return this;
+            }
+        case Language<T>::COMPLEMENT_LANGUAGE:
+            {
+                // Double negation
+                if (pattern->type == Language<T>::COMPLEMENT_LANGUAGE && pattern->pattern->type != Language<T>::LAZY_LANGUAGE)
+                {
+                    optimal = pattern->pattern;
+                    become(optimal);
                     return optimal;
                 }
 
@@ -505,10 +1454,137 @@ Language<T>* Language<T>::compact()
                     pattern->type == Language<T>::EMPTY_LANGUAGE)
                 {
                     optimal = &empty;
-                    optimal->marker = marker; // This should be unnecessary, unless optimal is &null or &empty
-                    *this = empty;
+                    become(optimal);
+                    return optimal;
+                }
+
+                return this;
+            }
+        case Language<T>::UNION_LANGUAGE:
+            {
+                // Associativity: flatten children that are themselves alternatives
+                bool nested = false;
+                for (Language<T>* child : children)
+                {
+                    if (child->flattensInto(this)) nested = true;
+                }
+
+                if (nested)
+                {
+                    std::vector<Language<T>*> flat;
+                    for (Language<T>* child : children)
+                    {
+                        if (!child->flattensInto(this))
+                        {
+                            flat.push_back(child);
+                        }
+                        else if (child->type == Language<T>::ALTERNATE_LANGUAGE)
+                        {
+                            flat.push_back(child->left);
+                            flat.push_back(child->right);
+                        }
+                        else
+                        {
+                            flat.insert(flat.end(), child->children.begin(), child->children.end());
+                        }
+                    }
+                    children.swap(flat);
+                }
+
+                // The null language contributes nothing, and neither does this node itself:
+                // the least fixed point of L = L | R is R. Children keep the order they
+                // were written in, which is the order parses are reported in, so they are
+                // not sorted; equivalent() compares unions in any order instead.
+                std::size_t kept = 0;
+                for (Language<T>* child : children)
+                {
+                    if (child == this || child->type == Language<T>::NULL_LANGUAGE) continue;
+                    children[kept++] = (child->type == Language<T>::EMPTY_LANGUAGE) ? &empty : child;
+                }
+                children.resize(kept);
+
+                // Idempotence: drop children equal to an earlier one, merging
+                // concatenations of the same head with the same suffix
+                if (children.size() <= 8)
+                {
+                    kept = 0;
+                    for (std::size_t i = 0; i < children.size(); ++i)
+                    {
+                        bool duplicate = false;
+                        for (std::size_t j = 0; j < kept && !duplicate; ++j)
+                        {
+                            duplicate = children[j]->key() == children[i]->key();
+                        }
+                        if (!duplicate) children[kept++] = children[i];
+                    }
+                    children.resize(kept);
+                }
+                else
+                {
+                    // Equal keys end up next to each other, the earliest first
+                    std::vector<std::size_t> order(children.size());
+                    for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+                    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b)
+                    {
+                        return children[a]->key() < children[b]->key();
+                    });
+
+                    std::vector<bool> duplicate(children.size(), false);
+                    for (std::size_t i = 1; i < order.size(); ++i)
+                    {
+                        if (children[order[i]]->key() == children[order[i - 1]]->key()) duplicate[order[i]] = true;
+                    }
+
+                    kept = 0;
+                    for (std::size_t i = 0; i < children.size(); ++i)
+                    {
+                        if (!duplicate[i]) children[kept++] = children[i];
+                    }
+                    children.resize(kept);
+                }
+
+                if (children.empty())
+                {
+                    optimal = &null;
+                    become(optimal);
+                    return optimal;
+                }
+                else if (children.size() == 1)
+                {
+                    optimal = children[0];
+                    become(optimal);
+                    return optimal;
+                }
+
+                return this;
+            }
+        case Language<T>::CONCATENATION_LANGUAGE:
+            {
+                if (left == nullptr) return this;
+
+                if (left->type == Language<T>::NULL_LANGUAGE)
+                {
+                    optimal = &null;
+                    become(optimal);
                     return optimal;
                 }
+                else if (left->type == Language<T>::EMPTY_LANGUAGE)
+                {
+                    if (offset + 1 == spine->children.size())
+                    {
+                        // The last child is a grammar node, whose memo may be stale
+                        optimal = spine->children[offset];
+                        if (optimal->marker != marker && optimal != &null && optimal != &empty)
+                        {
+                            optimal->marker = marker;
+                            optimal->memoize = nullptr;
+                        }
+                        become(optimal);
+                        return optimal;
+                    }
+
+                    left = nullptr;
+                }
 
                 return this;
             }
@@ -518,14 +1594,52 @@ Language<T>* Language<T>::compact()
     return nullptr;
 }
 
+template <typename T>
+bool Language<T>::flattensInto(const Language<T>* parent) const
+{
+    if (this == parent) return false;
+
+    // A node that is still being derived has unforced children, which must not be
+    // copied anywhere else. Large unions are left nested: copying their children into
+    // every union that refers to them would make each derivative step cost more than
+    // the size of the derivative, which breaks the cubic bound on matching.
+    switch (type)
+    {
+        case Language<T>::ALTERNATE_LANGUAGE:
+            return left->type != Language<T>::LAZY_LANGUAGE && right->type != Language<T>::LAZY_LANGUAGE;
+        case Language<T>::UNION_LANGUAGE:
+            if (children.size() > 8) return false;
+            for (const Language<T>* child : children)
+            {
+                if (child->type == Language<T>::LAZY_LANGUAGE) return false;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Identifies nodes for deduplicating unions; concatenations are identified by their
+// structure
+template <typename T>
+std::tuple<const void*, std::size_t, const void*> Language<T>::key() const
+{
+    if (type == Language<T>::CONCATENATION_LANGUAGE)
+    {
+        return std::make_tuple(static_cast<const void*>(spine.get()), offset, static_cast<const void*>(left));
+    }
+
+    return std::make_tuple(static_cast<const void*>(this), 0, nullptr);
+}
+
 template <typename T>
 struct IsDead
 {
-    IsDead(unsigned int m) : marker(m)
+    IsDead(std::uint64_t m) : marker(m)
     {
     }
 
-    unsigned int marker;
+    std::uint64_t marker;
 
     bool operator() (const Language<T>* lang) const
     {
@@ -533,16 +1647,75 @@ struct IsDead
     }
 };
 
-template <typename A>
-Language<char>* terminal(A& allocate, char c)
+template <typename T, typename A>
+Language<T>* terminal(A& allocate, T c)
 {
-    Language<char>* lit = allocate();
+    Language<T>* lit = allocate();
     lit->marker = 0;
-    lit->type = Language<char>::TERMINAL_LANGUAGE;
+    lit->anonymous = false;
+    lit->type = Language<T>::TERMINAL_LANGUAGE;
     lit->t = c;
     return lit;
 }
 
+// Any token in one of the inclusive ranges, which may overlap and come in any order
+template <typename T, typename A>
+Language<T>* range(A& allocate, std::vector<std::pair<T, T>> ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+
+    std::vector<std::pair<T, T>> merged;
+    for (const std::pair<T, T>& r : ranges)
+    {
+        if (r.first > r.second) continue;
+
+        if (!merged.empty() && (r.first <= merged.back().second || r.first - 1 == merged.back().second))
+        {
+            merged.back().second = std::max(merged.back().second, r.second);
+        }
+        else
+        {
+            merged.push_back(r);
+        }
+    }
+
+    if (merged.empty()) return &Language<T>::null;
+    if (merged.size() == 1 && merged[0].first == merged[0].second) return terminal(allocate, merged[0].first);
+
+    Language<T>* rng = allocate();
+    rng->marker = 0;
+    rng->memoize = nullptr;
+    rng->anonymous = false;
+    rng->type = Language<T>::RANGE_LANGUAGE;
+    rng->ranges = std::make_shared<const std::vector<std::pair<T, T>>>(std::move(merged));
+    return rng;
+}
+
+// Any token in none of the inclusive ranges
+template <typename T, typename A>
+Language<T>* except(A& allocate, std::vector<std::pair<T, T>> ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+
+    std::vector<std::pair<T, T>> gaps;
+    T next = std::numeric_limits<T>::min();
+    bool done = false;
+    for (const std::pair<T, T>& r : ranges)
+    {
+        if (r.first > r.second || r.second < next) continue;
+        if (r.first > next) gaps.push_back(std::make_pair(next, static_cast<T>(r.first - 1)));
+        if (r.second == std::numeric_limits<T>::max())
+        {
+            done = true;
+            break;
+        }
+        next = static_cast<T>(r.second + 1);
+    }
+    if (!done) gaps.push_back(std::make_pair(next, std::numeric_limits<T>::max()));
+
+    return range(allocate, gaps);
+}
+
 template <typename T, typename A>
 Language<T>* alternate(A& allocate, Language<T>* left, Language<T>* right)
 {
@@ -552,6 +1725,7 @@ Language<T>* alternate(A& allocate, Language<T>* left, Language<T>* right)
     alt->marker = 0;
     alt->memoize = nullptr;
     alt->leastFixedPointFound = false;
+    alt->anonymous = true;
     alt->type = Language<T>::ALTERNATE_LANGUAGE;
     alt->left = left;
     alt->right = right;
@@ -567,27 +1741,41 @@ Language<T>* sequence(A& allocate, Language<T>* left, Language<T>* right)
     seq->marker = 0;
     seq->memoize = nullptr;
     seq->leastFixedPointFound = false;
+    seq->anonymous = true;
     seq->type = Language<T>::SEQUENCE_LANGUAGE;
     seq->left = left;
     seq->right = right;
     return seq;
 }
 
-template <typename A>
-Language<char>* sequence(A& allocate, const std::string& str)
+template <typename T, typename A>
+Language<T>* sequence(A& allocate, const std::basic_string<T>& str)
 {
-    if (str.empty()) return &Language<char>::empty;
+    if (str.empty()) return &Language<T>::empty;
+    if (str.size() == 1) return terminal(allocate, str[0]);
 
-    Language<char>* lang = terminal(allocate, str.back());
-    for (auto i = str.crbegin() + 1; i != str.crend(); ++i)
-    {
-        lang = sequence(allocate, terminal(allocate, *i), lang);
-        // We know it's not nullable, so we can just set that now
-        lang->leastFixedPointFound = true;
-        lang->nullable = false;
-    }
+    Language<T>* lit = allocate();
+    lit->marker = 0;
+    lit->memoize = nullptr;
+    lit->anonymous = false;
+    lit->type = Language<T>::LITERAL_LANGUAGE;
+    lit->literal = std::make_shared<const std::basic_string<T>>(str);
+    lit->offset = 0;
+    return lit;
+}
 
-    return lang;
+// An empty language recording that a named language starts (or ends, if end is set)
+template <typename T, typename A>
+Language<T>* event(A& allocate, std::size_t name, bool end)
+{
+    Language<T>* evt = allocate();
+    evt->marker = 0;
+    evt->memoize = nullptr;
+    evt->anonymous = false;
+    evt->type = Language<T>::EVENT_LANGUAGE;
+    evt->event = name * 2 + (end ? 1 : 0);
+    evt->offset = std::string::npos;
+    return evt;
 }
 
 template <typename T, typename A>
@@ -597,26 +1785,211 @@ Language<T>* repetition(A& allocate, Language<T>* pattern)
     Language<T>* rep = allocate();
     rep->marker = 0;
     rep->memoize = nullptr;
+    rep->anonymous = false;
     rep->type = Language<T>::REPETITION_LANGUAGE;
     rep->pattern = pattern;
     return rep;
 }
 
+template <typename T, typename A>
+Language<T>* intersection(A& allocate, Language<T>* left, Language<T>* right)
+{
+    assert(left);
+    assert(right);
+    Language<T>* both = allocate();
+    both->marker = 0;
+    both->memoize = nullptr;
+    both->leastFixedPointFound = false;
+    both->anonymous = false;
+    both->type = Language<T>::INTERSECTION_LANGUAGE;
+    both->left = left;
+    both->right = right;
+    return both;
+}
+
+template <typename T, typename A>
+Language<T>* complement(A& allocate, Language<T>* pattern)
+{
+    assert(pattern);
+    Language<T>* comp = allocate();
+    comp->marker = 0;
+    comp->memoize = nullptr;
+    comp->leastFixedPointFound = false;
+    comp->anonymous = false;
+    comp->type = Language<T>::COMPLEMENT_LANGUAGE;
+    comp->pattern = pattern;
+    return comp;
+}
+
 template <typename A>
 Language<char>* anyOf(A& allocate, const std::string& str)
 {
     if (str.empty()) return &Language<char>::empty;
 
-    Language<char>* lang = terminal(allocate, str[0]);
-    for (auto i = str.cbegin() + 1; i != str.cend(); ++i)
+    std::string chars = str;
+    std::sort(chars.begin(), chars.end());
+    chars.erase(std::unique(chars.begin(), chars.end()), chars.end());
+    if (chars.size() == 1) return terminal(allocate, chars[0]);
+
+    Language<char>* uni = allocate();
+    uni->marker = 0;
+    uni->memoize = nullptr;
+    uni->anonymous = true;
+    uni->type = Language<char>::UNION_LANGUAGE;
+    uni->children.clear();
+    for (char c : chars)
     {
-        lang = alternate(allocate, lang, terminal(allocate, *i));
-        // We know it's not nullable, so we can just set that now
-        lang->leastFixedPointFound = true;
-        lang->nullable = false;
+        uni->children.push_back(terminal(allocate, c));
     }
 
-    return lang;
+    // We know it's not nullable, so we can just set that now
+    uni->leastFixedPointFound = true;
+    uni->nullable = false;
+
+    return uni;
+}
+
+// Alternates left with right, extending left in place if it is an alternation that
+// only a temporary refers to
+template <typename T, typename A>
+Language<T>* unite(A& allocate, Language<T>* left, Language<T>* right)
+{
+    assert(left);
+    assert(right);
+    if (!left->anonymous) return alternate(allocate, left, right);
+
+    if (left->type == Language<T>::ALTERNATE_LANGUAGE)
+    {
+        left->type = Language<T>::UNION_LANGUAGE;
+        left->children.clear();
+        left->children.push_back(left->left);
+        left->children.push_back(left->right);
+    }
+    else if (left->type != Language<T>::UNION_LANGUAGE)
+    {
+        return alternate(allocate, left, right);
+    }
+
+    if (std::find(left->children.begin(), left->children.end(), right) == left->children.end())
+    {
+        left->children.push_back(right);
+        left->leastFixedPointFound = false;
+    }
+
+    return left;
+}
+
+// Sequences left with right, extending left in place if it is a sequence that only
+// a temporary refers to
+template <typename T, typename A>
+Language<T>* concatenate(A& allocate, Language<T>* left, Language<T>* right)
+{
+    assert(left);
+    assert(right);
+    if (!left->anonymous) return sequence(allocate, left, right);
+
+    if (left->type == Language<T>::SEQUENCE_LANGUAGE)
+    {
+        std::shared_ptr<Spine<T>> spine = std::make_shared<Spine<T>>();
+        spine->push_back(left->left);
+        spine->push_back(left->right);
+
+        left->type = Language<T>::CONCATENATION_LANGUAGE;
+        left->left = nullptr;
+        left->spine = spine;
+        left->offset = 0;
+    }
+    else if (left->type != Language<T>::CONCATENATION_LANGUAGE || left->left != nullptr)
+    {
+        return sequence(allocate, left, right);
+    }
+
+    left->spine->push_back(right);
+    left->leastFixedPointFound = false;
+
+    return left;
+}
+
+// Copies the graph reachable from roots into nodes from allocate, with spines of their
+// own, so that the copy shares no state with the original. Each copy is passed to
+// stand(node, copy), which returns what refers to it in place of the node (usually
+// the copy itself); image maps each node to that.
+template <typename T, typename A, typename F>
+void copy(A& allocate, const std::vector<const Language<T>*>& roots, std::unordered_map<const Language<T>*, Language<T>*>& image, F stand)
+{
+    std::vector<Language<T>*> copies;
+    image.emplace(&Language<T>::null, &Language<T>::null);
+    image.emplace(&Language<T>::empty, &Language<T>::empty);
+
+    std::vector<const Language<T>*> pending;
+    for (const Language<T>* root : roots)
+    {
+        if (image.emplace(root, nullptr).second) pending.push_back(root);
+    }
+
+    while (!pending.empty())
+    {
+        const Language<T>* node = pending.back();
+        pending.pop_back();
+
+        Language<T>* copy = allocate();
+        *copy = *node;
+        copy->marker = 0;
+        copy->memoize = nullptr;
+        copy->anonymous = false;
+        copies.push_back(copy);
+        image[node] = stand(node, copy);
+
+        node->forEachChild([&](const Language<T>* child)
+        {
+            if (image.emplace(child, nullptr).second) pending.push_back(child);
+        });
+    }
+
+    std::unordered_map<const Spine<T>*, std::shared_ptr<Spine<T>>> spines;
+    for (Language<T>* copy : copies)
+    {
+        switch (copy->type)
+        {
+            case Language<T>::LAZY_LANGUAGE:
+                if (copy->pattern != nullptr) copy->pattern = image[copy->pattern];
+                break;
+            case Language<T>::ALTERNATE_LANGUAGE:
+            case Language<T>::SEQUENCE_LANGUAGE:
+            case Language<T>::INTERSECTION_LANGUAGE:
+                copy->left = image[copy->left];
+                copy->right = image[copy->right];
+                break;
+            case Language<T>::REPETITION_LANGUAGE:
+            case Language<T>::COMPLEMENT_LANGUAGE:
+                copy->pattern = image[copy->pattern];
+                break;
+            case Language<T>::UNION_LANGUAGE:
+                for (Language<T>*& child : copy->children)
+                {
+                    child = image[child];
+                }
+                break;
+            case Language<T>::CONCATENATION_LANGUAGE:
+                {
+                    if (copy->left != nullptr) copy->left = image[copy->left];
+
+                    std::shared_ptr<Spine<T>>& spine = spines[copy->spine.get()];
+                    if (!spine)
+                    {
+                        spine = std::make_shared<Spine<T>>();
+                        for (Language<T>* child : copy->spine->children)
+                        {
+                            spine->push_back(image[child]);
+                        }
+                    }
+                    copy->spine = spine;
+                    break;
+                }
+            default:
+                break;
+        }
+    }
 }
 
 } // namespace priv
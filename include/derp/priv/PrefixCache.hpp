@@ -0,0 +1,275 @@
+#ifndef LIB_DERP_PRIV_PREFIX_CACHE_HPP
+#define LIB_DERP_PRIV_PREFIX_CACHE_HPP
+
+#include "Alphabet.hpp"
+#include "Language.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <cassert>
+
+namespace derp
+{
+
+// How well a prefix cache is doing
+struct PrefixCacheStats
+{
+    std::size_t lookups = 0;   // Inputs looked up
+    std::size_t hits = 0;      // Inputs that resumed from a cached prefix
+    std::size_t skipped = 0;   // Tokens that did not need deriving thanks to the cache
+    std::size_t evictions = 0; // Prefixes evicted to stay within capacity
+
+    double hitRate() const { return (lookups != 0) ? static_cast<double>(hits) / lookups : 0.0; }
+};
+
+namespace priv
+{
+
+// A trie of input prefixes holding the derivative of the grammar by each of them, so
+// that matching an input can resume from its longest cached prefix. Prefixes are
+// spelled in byte classes of the grammar's alphabet, so inputs that differ only in
+// bytes the grammar cannot tell apart share their entries. The nodes of the
+// cached derivatives are stolen from the collector, and capacity bounds them together
+// with the prefixes. Derivatives hold no lazy nodes once derive() returns, so later
+// matches only ever update their markers and memos, which the epoch keeps stale.
+template <typename A>
+class PrefixCache
+{
+public:
+    PrefixCache(A& gc, Language<char>* root, const Alphabet& alphabet, std::size_t capacity, std::size_t depth);
+    ~PrefixCache();
+
+    PrefixCache(const PrefixCache<A>&) = delete;
+    PrefixCache<A>& operator= (const PrefixCache<A>&) = delete;
+
+    bool enabled() const { return capacity != 0; }
+
+    // Nodes and prefixes held, which capacity bounds
+    std::size_t size() const { return pinned.size() + entries.size() - free.size(); }
+
+    const PrefixCacheStats& stats() const { return statistics; }
+
+    // Returns the derivative by the longest cached prefix of [i, end), advancing i past
+    // it and setting entry to its prefix
+    Language<char>* resume(const char*& i, const char* end, std::size_t& entry);
+
+    // Whether the prefix of entry is short enough to extend
+    bool extends(std::size_t entry) const { return entries[entry].depth < depth; }
+
+    // Caches lang, just derived with counter and collected, as the derivative by the
+    // prefix of entry followed by c, and returns the new prefix
+    std::size_t insert(std::size_t entry, char c, Language<char>* lang, std::uint64_t counter);
+
+    // Ends a match that last used entry, evicting the least recently used prefixes while
+    // the cache is over capacity. Matching must not be under way.
+    void finish(std::size_t entry);
+
+private:
+    static const std::size_t NONE = static_cast<std::size_t>(-1);
+
+    struct Entry
+    {
+        Language<char>* lang;
+        std::size_t parent;
+        std::size_t depth;
+        std::size_t children;
+        unsigned char c;
+
+        // Recency list, from the oldest prefix to the newest
+        std::size_t older;
+        std::size_t newer;
+    };
+
+    static std::uint64_t key(std::size_t entry, unsigned char c)
+    {
+        return (static_cast<std::uint64_t>(entry) << 8) | c;
+    }
+
+    void unlink(std::size_t entry);
+    void touch(std::size_t entry);
+    void evict(std::size_t entry);
+    void sweep();
+
+    A& gc;
+    const Alphabet& alphabet;
+    std::size_t capacity;
+    std::size_t depth;
+
+    // The root prefix (the empty one) is entry 0, which is never evicted nor in the
+    // recency list
+    std::vector<Entry> entries;
+    std::vector<std::size_t> free;
+    std::unordered_map<std::uint64_t, std::size_t> index;
+    std::size_t oldest;
+    std::size_t newest;
+
+    std::vector<Language<char>*> pinned;
+
+    PrefixCacheStats statistics;
+};
+
+template <typename A>
+PrefixCache<A>::PrefixCache(A& gc, Language<char>* root, const Alphabet& alphabet, std::size_t capacity, std::size_t depth) :
+    gc(gc), alphabet(alphabet), capacity(capacity), depth(depth), oldest(NONE), newest(NONE)
+{
+    Entry entry;
+    entry.lang = root;
+    entry.parent = NONE;
+    entry.depth = 0;
+    entry.children = 0;
+    entry.c = 0;
+    entry.older = NONE;
+    entry.newer = NONE;
+    entries.push_back(entry);
+}
+
+template <typename A>
+PrefixCache<A>::~PrefixCache()
+{
+    gc.release(pinned, [](const Language<char>*) { return true; });
+}
+
+template <typename A>
+Language<char>* PrefixCache<A>::resume(const char*& i, const char* end, std::size_t& entry)
+{
+    ++statistics.lookups;
+
+    entry = 0;
+    while (i != end)
+    {
+        auto found = index.find(key(entry, alphabet[*i]));
+        if (found == index.end()) break;
+
+        entry = found->second;
+        ++i;
+    }
+
+    if (entry != 0)
+    {
+        ++statistics.hits;
+        statistics.skipped += entries[entry].depth;
+    }
+
+    return entries[entry].lang;
+}
+
+template <typename A>
+std::size_t PrefixCache<A>::insert(std::size_t entry, char c, Language<char>* lang, std::uint64_t counter)
+{
+    assert(extends(entry));
+
+    // Steal the nodes of the derivative that are still up for collection, which are
+    // the ones the last derivation marked
+    std::uint64_t keep = ++gc.epoch;
+    lang->remark(counter, keep);
+    gc.steal(pinned, [keep](const Language<char>* node) { return node->marker == keep; });
+
+    std::size_t child;
+    if (free.empty())
+    {
+        child = entries.size();
+        entries.emplace_back();
+    }
+    else
+    {
+        child = free.back();
+        free.pop_back();
+    }
+
+    Entry& e = entries[child];
+    e.lang = lang;
+    e.parent = entry;
+    e.depth = entries[entry].depth + 1;
+    e.children = 0;
+    e.c = alphabet[c];
+    e.older = NONE;
+    e.newer = NONE;
+
+    ++entries[entry].children;
+    index.emplace(key(entry, e.c), child);
+    touch(child);
+
+    return child;
+}
+
+template <typename A>
+void PrefixCache<A>::finish(std::size_t entry)
+{
+    // Parents are kept newer than their children, so the oldest prefix is always a leaf
+    for (; entry != 0; entry = entries[entry].parent)
+    {
+        touch(entry);
+    }
+
+    while (size() > capacity && oldest != NONE)
+    {
+        // Evict in batches, as only sweeping frees the nodes of evicted derivatives
+        std::size_t batch = (entries.size() - free.size()) / 4 + 1;
+        for (; batch != 0 && oldest != NONE; --batch)
+        {
+            evict(oldest);
+        }
+
+        sweep();
+    }
+}
+
+template <typename A>
+void PrefixCache<A>::unlink(std::size_t entry)
+{
+    Entry& e = entries[entry];
+    if (e.older != NONE) entries[e.older].newer = e.newer; else if (oldest == entry) oldest = e.newer;
+    if (e.newer != NONE) entries[e.newer].older = e.older; else if (newest == entry) newest = e.older;
+    e.older = NONE;
+    e.newer = NONE;
+}
+
+template <typename A>
+void PrefixCache<A>::touch(std::size_t entry)
+{
+    unlink(entry);
+
+    Entry& e = entries[entry];
+    e.older = newest;
+    if (newest != NONE) entries[newest].newer = entry;
+    newest = entry;
+    if (oldest == NONE) oldest = entry;
+}
+
+template <typename A>
+void PrefixCache<A>::evict(std::size_t entry)
+{
+    Entry& e = entries[entry];
+    assert(entry != 0);
+    assert(e.children == 0);
+
+    unlink(entry);
+    index.erase(key(e.parent, e.c));
+    --entries[e.parent].children;
+    e.lang = nullptr;
+    free.push_back(entry);
+
+    ++statistics.evictions;
+}
+
+// Frees the pinned nodes that no cached derivative reaches anymore
+template <typename A>
+void PrefixCache<A>::sweep()
+{
+    std::uint64_t counter = ++gc.epoch;
+    for (std::size_t i = 1; i < entries.size(); ++i)
+    {
+        if (entries[i].lang != nullptr) entries[i].lang->mark(counter);
+    }
+
+    gc.release(pinned, IsDead<char>(counter));
+}
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef LIB_DERP_PRIV_PROFILE_ALLOCATOR_HPP
+#define LIB_DERP_PRIV_PROFILE_ALLOCATOR_HPP
+
+#include "Language.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace derp
+{
+
+namespace priv
+{
+
+// Where time was spent: a rule, reached from the rules of its parent frame. Recursion
+// into the same rule stays in the same frame.
+struct ProfileFrame
+{
+    std::size_t rule;
+    std::size_t parent;
+    std::uint64_t nanoseconds;
+};
+
+// Forwards allocations to a garbage collector, attributing derivations, memo hits,
+// allocations and time to the rule that owns the node being derived. Nodes are tagged
+// with the rule they belong to; the grammar's up front, and derivatives with the rule
+// whose derivation allocates them. Untagged nodes (such as null and empty) belong to
+// the rule deriving them.
+template <typename T, typename A>
+struct ProfileAllocator
+{
+    typedef std::chrono::steady_clock Clock;
+
+    ProfileAllocator(A& gc, std::size_t rules) :
+        gc(gc), derives(rules, 0), memoHits(rules, 0), allocations(rules, 0), frames(1, ProfileFrame{0, 0, 0}),
+        stack(1, 0), last(Clock::now())
+    {
+    }
+
+    A& gc;
+
+    std::unordered_map<const Language<T>*, std::size_t> tags;
+
+    std::vector<std::size_t> derives;
+    std::vector<std::size_t> memoHits;
+    std::vector<std::size_t> allocations;
+
+    // Frame 0 is the root of the match, which belongs to rule 0
+    std::vector<ProfileFrame> frames;
+    std::unordered_map<std::uint64_t, std::size_t> children;
+    std::vector<std::size_t> stack;
+    Clock::time_point last;
+
+    std::size_t rule() const
+    {
+        return frames[stack.back()].rule;
+    }
+
+    // Charges the time since the last call to the frame on top of the stack
+    void charge()
+    {
+        Clock::time_point now = Clock::now();
+        frames[stack.back()].nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        last = now;
+    }
+
+    void enter(const Language<T>* lang)
+    {
+        charge();
+
+        auto tag = tags.find(lang);
+        std::size_t r = (tag != tags.end()) ? tag->second : rule();
+        ++derives[r];
+        push(r);
+    }
+
+    void exit()
+    {
+        charge();
+        stack.pop_back();
+    }
+
+    // Enters the frame of rule r under the one on top of the stack
+    void push(std::size_t r)
+    {
+        std::size_t frame = stack.back();
+        if (frames[frame].rule != r)
+        {
+            std::uint64_t key = static_cast<std::uint64_t>(frame) * derives.size() + r;
+            auto child = children.find(key);
+            if (child != children.end())
+            {
+                frame = child->second;
+            }
+            else
+            {
+                children.emplace(key, frames.size());
+                frames.push_back(ProfileFrame{r, frame, 0});
+                frame = frames.size() - 1;
+            }
+        }
+
+        stack.push_back(frame);
+    }
+
+    Language<T>* operator() ()
+    {
+        Language<T>* lang = gc();
+        std::size_t r = rule();
+        tags[lang] = r;
+        ++allocations[r];
+        return lang;
+    }
+};
+
+template <typename T, typename A>
+inline void onDerive(ProfileAllocator<T, A>& allocate, const Language<T>* lang)
+{
+    allocate.enter(lang);
+}
+
+template <typename T, typename A>
+inline void onDerived(ProfileAllocator<T, A>& allocate, const Language<T>*)
+{
+    allocate.exit();
+}
+
+template <typename T, typename A>
+inline void onMemoHit(ProfileAllocator<T, A>& allocate, const Language<T>*)
+{
+    ++allocate.memoHits[allocate.rule()];
+}
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
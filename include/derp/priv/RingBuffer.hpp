@@ -0,0 +1,87 @@
+#ifndef LIB_DERP_PRIV_RING_BUFFER_HPP
+#define LIB_DERP_PRIV_RING_BUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace derp
+{
+
+namespace priv
+{
+
+// A bounded queue between exactly one producer thread and one consumer thread, with no
+// locks. Each side owns one index and only reads the other's when its cached copy says
+// the queue looks full (or empty), so the two cores rarely touch the same cache line.
+template <typename T>
+class RingBuffer
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit RingBuffer(std::size_t capacity);
+
+    // Producer: false if the queue is full
+    bool push(const T& value);
+
+    // Consumer: false if the queue is empty
+    bool pop(T& value);
+
+private:
+    std::vector<T> slots;
+    std::size_t mask;
+
+    // Written by the consumer: the next slot to pop, and its copy of tail
+    alignas(64) std::atomic<std::size_t> head;
+    std::size_t tailSeen;
+
+    // Written by the producer: the next slot to push, and its copy of head
+    alignas(64) std::atomic<std::size_t> tail;
+    std::size_t headSeen;
+};
+
+template <typename T>
+RingBuffer<T>::RingBuffer(std::size_t capacity) :
+    head(0), tailSeen(0), tail(0), headSeen(0)
+{
+    std::size_t size = 2;
+    while (size < capacity) size *= 2;
+    slots.resize(size);
+    mask = size - 1;
+}
+
+template <typename T>
+bool RingBuffer<T>::push(const T& value)
+{
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    if (t - headSeen == slots.size())
+    {
+        headSeen = head.load(std::memory_order_acquire);
+        if (t - headSeen == slots.size()) return false;
+    }
+
+    slots[t & mask] = value;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool RingBuffer<T>::pop(T& value)
+{
+    std::size_t h = head.load(std::memory_order_relaxed);
+    if (h == tailSeen)
+    {
+        tailSeen = tail.load(std::memory_order_acquire);
+        if (h == tailSeen) return false;
+    }
+
+    value = slots[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef LIB_DERP_PRIV_SIMD_HPP
+#define LIB_DERP_PRIV_SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LIB_DERP_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIB_DERP_SSE2
+#endif
+
+namespace derp
+{
+
+namespace priv
+{
+
+// Index of the lowest set bit of a non-zero movemask result
+inline std::size_t lowestBit(std::uint32_t mask)
+{
+    std::size_t n = 0;
+    while (!((mask >> n) & 1)) ++n;
+    return n;
+}
+
+// Returns the length of the common prefix of a and b, which are both n bytes long
+inline std::size_t commonPrefix(const char* a, const char* b, std::size_t n)
+{
+    std::size_t i = 0;
+
+#if defined(LIB_DERP_AVX2)
+    for (; n - i >= 32; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        std::uint32_t differ = ~static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+        if (differ != 0) return i + lowestBit(differ);
+    }
+#elif defined(LIB_DERP_SSE2)
+    for (; n - i >= 16; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        std::uint32_t differ = ~static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) & 0xFFFF;
+        if (differ != 0) return i + lowestBit(differ);
+    }
+#endif
+
+    while (i != n && a[i] == b[i]) ++i;
+    return i;
+}
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef LIB_DERP_PRIV_TRACE_ALLOCATOR_HPP
+#define LIB_DERP_PRIV_TRACE_ALLOCATOR_HPP
+
+#include "Language.hpp"
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace derp
+{
+
+namespace priv
+{
+
+// Forwards allocations to a garbage collector, counting them along with derivations
+// and memo hits, and keeping the nodes allocated since it was last reset. Derivations
+// of the nodes in heat (the grammar) are counted per node.
+template <typename T, typename A>
+struct TraceAllocator
+{
+    TraceAllocator(A& gc, std::unordered_map<const Language<T>*, std::size_t>& heat) :
+        gc(gc), heat(heat), allocations(0), derives(0), memoHits(0)
+    {
+    }
+
+    A& gc;
+    std::unordered_map<const Language<T>*, std::size_t>& heat;
+
+    std::size_t allocations;
+    std::size_t derives;
+    std::size_t memoHits;
+    std::vector<const Language<T>*> allocated;
+
+    Language<T>* operator() ()
+    {
+        ++allocations;
+        Language<T>* node = gc();
+        allocated.push_back(node);
+        return node;
+    }
+};
+
+template <typename T, typename A>
+inline void onDerive(TraceAllocator<T, A>& allocate, const Language<T>* lang)
+{
+    ++allocate.derives;
+
+    auto i = allocate.heat.find(lang);
+    if (i != allocate.heat.end()) ++i->second;
+}
+
+template <typename T, typename A>
+inline void onMemoHit(TraceAllocator<T, A>& allocate, const Language<T>*)
+{
+    ++allocate.memoHits;
+}
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef LIB_DERP_PRIV_UTF8_HPP
+#define LIB_DERP_PRIV_UTF8_HPP
+
+#include "Simd.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace derp
+{
+
+namespace priv
+{
+
+// The UTF-8 encoding of a code point
+inline std::string encode(char32_t c)
+{
+    std::string str;
+    if (c < 0x80)
+    {
+        str += static_cast<char>(c);
+    }
+    else if (c < 0x800)
+    {
+        str += static_cast<char>(0xC0 | (c >> 6));
+        str += static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else if (c < 0x10000)
+    {
+        str += static_cast<char>(0xE0 | (c >> 12));
+        str += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        str += static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else
+    {
+        str += static_cast<char>(0xF0 | (c >> 18));
+        str += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+        str += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        str += static_cast<char>(0x80 | (c & 0x3F));
+    }
+
+    return str;
+}
+
+// Tokens as text, for printing languages
+inline std::string text(char c)
+{
+    return std::string(1, c);
+}
+
+inline std::string text(char32_t c)
+{
+    // Past the last code point, nothing encodes it
+    if (c > 0x10FFFF)
+    {
+        char escape[16];
+        std::snprintf(escape, sizeof(escape), "\\u{%X}", static_cast<unsigned int>(c));
+        return escape;
+    }
+
+    return encode(c);
+}
+
+template <typename T>
+std::string text(const T* begin, const T* end)
+{
+    std::string str;
+    for (const T* i = begin; i != end; ++i)
+    {
+        str += text(*i);
+    }
+
+    return str;
+}
+
+// Inclusive ranges of tokens as a character class
+template <typename T>
+std::string text(const std::vector<std::pair<T, T>>& ranges)
+{
+    std::string str = "[";
+    for (const std::pair<T, T>& range : ranges)
+    {
+        str += (range.first == range.second) ? text(range.first) : text(range.first) + "-" + text(range.second);
+    }
+
+    return str + "]";
+}
+
+// Returns the offset of the first byte of the first ill-formed sequence in [begin,
+// end), or the size if there is none. Well-formed sequences are those of the Unicode
+// standard (table 3-7): no overlong forms, surrogates or code points past U+10FFFF.
+// Runs of ASCII are checked a vector at a time.
+inline std::size_t validUtf8(const char* begin, const char* end)
+{
+    const unsigned char* i = reinterpret_cast<const unsigned char*>(begin);
+    const unsigned char* e = reinterpret_cast<const unsigned char*>(end);
+
+    while (i != e)
+    {
+#if defined(LIB_DERP_AVX2)
+        while (e - i >= 32)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(i));
+            std::uint32_t high = static_cast<std::uint32_t>(_mm256_movemask_epi8(block));
+            if (high != 0)
+            {
+                i += lowestBit(high);
+                break;
+            }
+            i += 32;
+        }
+#elif defined(LIB_DERP_SSE2)
+        while (e - i >= 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(i));
+            std::uint32_t high = static_cast<std::uint32_t>(_mm_movemask_epi8(block));
+            if (high != 0)
+            {
+                i += lowestBit(high);
+                break;
+            }
+            i += 16;
+        }
+#endif
+        if (i == e) break;
+
+        unsigned char b = *i;
+        if (b < 0x80)
+        {
+            ++i;
+            continue;
+        }
+
+        // The length of the sequence, and the bounds of its second byte
+        std::size_t length;
+        unsigned char low = 0x80;
+        unsigned char high = 0xBF;
+        if (b >= 0xC2 && b <= 0xDF)
+        {
+            length = 2;
+        }
+        else if (b >= 0xE0 && b <= 0xEF)
+        {
+            length = 3;
+            if (b == 0xE0) low = 0xA0;
+            if (b == 0xED) high = 0x9F;
+        }
+        else if (b >= 0xF0 && b <= 0xF4)
+        {
+            length = 4;
+            if (b == 0xF0) low = 0x90;
+            if (b == 0xF4) high = 0x8F;
+        }
+        else
+        {
+            break;
+        }
+
+        if (static_cast<std::size_t>(e - i) < length || i[1] < low || i[1] > high) break;
+
+        bool valid = true;
+        for (std::size_t k = 2; k < length; ++k)
+        {
+            if ((i[k] & 0xC0) != 0x80) valid = false;
+        }
+        if (!valid) break;
+
+        i += length;
+    }
+
+    return static_cast<std::size_t>(reinterpret_cast<const char*>(i) - begin);
+}
+
+// Decodes the code point at i, which must start a well-formed sequence, and moves i past it
+inline char32_t decodeUtf8(const char*& i)
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(i);
+    char32_t c;
+    if (p[0] < 0x80)
+    {
+        c = p[0];
+        i += 1;
+    }
+    else if (p[0] < 0xE0)
+    {
+        c = (static_cast<char32_t>(p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+        i += 2;
+    }
+    else if (p[0] < 0xF0)
+    {
+        c = (static_cast<char32_t>(p[0] & 0x0F) << 12) | (static_cast<char32_t>(p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+        i += 3;
+    }
+    else
+    {
+        c = (static_cast<char32_t>(p[0] & 0x07) << 18) | (static_cast<char32_t>(p[1] & 0x3F) << 12) |
+            (static_cast<char32_t>(p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+        i += 4;
+    }
+
+    return c;
+}
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
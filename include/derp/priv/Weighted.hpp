@@ -0,0 +1,70 @@
+#ifndef LIB_DERP_PRIV_WEIGHTED_HPP
+#define LIB_DERP_PRIV_WEIGHTED_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace derp
+{
+
+namespace priv
+{
+
+// A node of a weighted language, whose words each come with a weight of the semiring S
+// (summing up the weights of their parses). Unlike Language, weighted languages are
+// never simplified in ways that assume a language is the same as twice itself.
+template <typename S>
+struct Weighted
+{
+    typedef typename S::Value Value;
+
+    enum Type
+    {
+        ZERO_LANGUAGE,
+        ONE_LANGUAGE,
+        TERMINAL_LANGUAGE,
+        LITERAL_LANGUAGE,
+        ALTERNATE_LANGUAGE,
+        SEQUENCE_LANGUAGE,
+        REPETITION_LANGUAGE,
+        WEIGHT_LANGUAGE
+    };
+
+    Type type;
+
+    // For TERMINAL
+    char t;
+
+    // For LITERAL, which is what remains of the string from offset on
+    std::shared_ptr<const std::string> literal;
+    std::size_t offset;
+
+    // For ALTERNATE and SEQUENCE; REPETITION and WEIGHT have their language on the left
+    Weighted<S>* left;
+    Weighted<S>* right;
+
+    // For WEIGHT, which weighs the words of its language with weight times their own
+    Value weight;
+
+    // The weight of the empty word, and whether there is any word at all
+    Value null;
+    bool nonempty;
+
+    // Grammar nodes are never collected, and fresh ones were made by the current token
+    bool grammar;
+    bool fresh;
+
+    // The derivative by the token of the current counter, or the fresh node standing in
+    // for this one once the derivative is simplified
+    std::uint64_t marker;
+    Weighted<S>* memoize;
+    Weighted<S>* forward;
+};
+
+} // namespace priv
+
+} // namespace derp
+
+#endif
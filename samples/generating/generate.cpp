@@ -0,0 +1,61 @@
+#include <derp/Generator.hpp>
+#include <derp/Language.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// Usage: generate [output] [max states] [max nodes]
+//
+// Writes a table-driven matcher for settings like "depth = 3" or "path = [a, [b, c]]"
+// to output (or to standard output). Lists nest, so matching them is left to the
+// derivative engine, through derp::Resume:
+//
+//     #include "settings.hpp"
+//     derp::Resume<Language> resume(setting);
+//     settings::matches(input.data(), input.size(), resume);
+int main(int argc, char** argv)
+{
+    using Language = derp::Language<char>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    GC gc;
+    Factory F(gc);
+
+    // identifier = [_a-z]+
+    // number = '-'? [0-9]+
+    // whitespace = ' '*
+    Language identifier = +(F('_') | F.range('a', 'z'));
+    Language number = -F('-') & +F.range('0', '9');
+    Language whitespace = *F(' ');
+
+    // value = identifier | number | list
+    // list = '[' whitespace (value whitespace (',' whitespace value whitespace)*)? ']'
+    // setting = identifier whitespace '=' whitespace value
+    Language value = F();
+    Language list = F();
+    Language items = value & whitespace & *(F(',') & whitespace & value & whitespace);
+    value = identifier | number | list;
+    list = F('[') & whitespace & -items & ']';
+    Language setting = identifier & whitespace & '=' & whitespace & value;
+
+    std::size_t maxStates = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 1024;
+    std::size_t maxNodes = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 256;
+
+    derp::Generator<Language> generator(setting, maxStates, maxNodes);
+    std::string source = generator.generate("settings");
+
+    std::cerr << generator.states() << " states over " << generator.byteClasses() << " classes of bytes, "
+              << generator.resumed() << " of them left to the derivative engine" << std::endl;
+
+    if (argc > 1)
+    {
+        std::ofstream(argv[1]) << source;
+    }
+    else
+    {
+        std::cout << source;
+    }
+}
@@ -0,0 +1,87 @@
+#include <derp/Language.hpp>
+#include <derp/Sampler.hpp>
+
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// Usage: sample [size] [seed] [megabytes]
+//
+// Writes random JSON-like values of about size bytes, as a load test would feed a
+// parser, and reports how fast they are written and how close to size they came. A
+// sample of them (and of near misses) is checked by matching.
+int main(int argc, char** argv)
+{
+    using Language = derp::Language<char>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    GC gc;
+    Factory F(gc);
+
+    // whitespace = ' '*
+    // string = '"' [a-z ]* '"'
+    // number = '-'? [0-9]+ ('.' [0-9]+)?
+    Language whitespace = *F(' ');
+    Language string = F('"') & *(F.range('a', 'z') | ' ') & '"';
+    Language digits = +F.range('0', '9');
+    Language number = -F('-') & digits & -(F('.') & digits);
+
+    // value = string | number | "true" | "false" | "null" | array | object
+    // array = '[' whitespace (value whitespace (',' whitespace value whitespace)*)? ']'
+    // object = '{' whitespace (member (',' whitespace member)*)? '}'
+    // member = string whitespace ':' whitespace value whitespace
+    Language value = F();
+    Language array = F();
+    Language object = F();
+    Language items = value & whitespace & *(F(',') & whitespace & value & whitespace);
+    Language member = string & whitespace & ':' & whitespace & value & whitespace;
+    value = string | number | F("true") | F("false") | F("null") | array | object;
+    array = F('[') & whitespace & -items & ']';
+    object = F('{') & whitespace & -(member & *(F(',') & whitespace & member)) & '}';
+
+    std::size_t size = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 64;
+    std::uint64_t seed = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 1;
+    std::size_t megabytes = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 64;
+    assert(size > 0);
+
+    // Nesting deep enough for values to grow to the size asked for, but capped well past it
+    derp::Sampler<Language> sampler(value, seed, 48, size * 4, 0.5, size);
+    sampler.weigh(array, 3);
+    sampler.weigh(object, 3);
+
+    std::string out;
+    std::size_t sentences = 0;
+    std::size_t total = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (total < megabytes << 20)
+    {
+        out.clear();
+        bool sampled = sampler.sentence(out);
+        assert(sampled);
+        (void)sampled;
+        total += out.size();
+        ++sentences;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << sentences << " sentences, " << total / (sentences ? sentences : 1) << " bytes on average (of "
+              << size << " asked for), at "
+              << total / elapsed.count() / (1 << 20) << " MB/s" << std::endl;
+
+    std::size_t mismatches = 0;
+    for (int i = 0; i < 200; ++i)
+    {
+        out.clear();
+        if (sampler.sentence(out) && !derp::matches(out, value)) ++mismatches;
+
+        out.clear();
+        if (sampler.nearMiss(out) && derp::matches(out, value)) ++mismatches;
+    }
+    std::cout << "example: " << out << std::endl;
+    std::cout << mismatches << " mismatches" << std::endl;
+
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,67 @@
+#include <derp/Language.hpp>
+#include <derp/Semiring.hpp>
+#include <derp/Weigher.hpp>
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+int main()
+{
+    using Language = derp::Language<char>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    GC gc;
+    Factory F(gc);
+
+    // word = "a" | "an" | "and" | "android" | "droid" | "roid" | "id" | "i" | "d" | "ro"
+    // sentence = word*
+    std::vector<std::string> dictionary{"a", "an", "and", "android", "droid", "roid", "id", "i", "d", "ro"};
+
+    // Every word costs one, and short words a little more, so the cheapest parse
+    // splits the input into the fewest and longest words
+    std::vector<Language> words;
+    std::vector<std::pair<Language, double>> costs;
+    for (const std::string& word : dictionary)
+    {
+        words.push_back(F(word));
+        costs.emplace_back(words.back(), 1.0 + 1.0 / word.size());
+    }
+
+    // Assigning to a language changes it in place, so each union is a language of its own
+    std::vector<Language> unions(1, words[0]);
+    for (std::size_t i = 1; i < words.size(); ++i)
+    {
+        unions.push_back(unions.back() | words[i]);
+    }
+    Language sentence = *unions.back();
+
+    std::vector<std::pair<Language, derp::KBest<3>::Value>> bestCosts(costs.begin(), costs.end());
+
+    derp::Weigher<Language> count(sentence);
+    derp::Weigher<Language, derp::Tropical> cheapest(sentence, costs);
+    derp::Weigher<Language, derp::KBest<3>> best(sentence, bestCosts);
+
+    std::cout << "grammar: (\"a\" | \"an\" | \"and\" | \"android\" | \"droid\" | \"roid\" | \"id\" | \"i\" | \"d\" | \"ro\")*" << std::endl;
+
+    std::string input;
+    while (std::cout << "input: " << std::flush, std::getline(std::cin, input))
+    {
+        std::uint64_t parses = count.weigh(input);
+        std::cout << "parses: ";
+        if (parses == derp::Counting::infinite()) std::cout << "too many to count"; else std::cout << parses;
+        std::cout << std::endl;
+
+        std::cout << "cheapest: " << cheapest.weigh(input) << std::endl;
+
+        derp::KBest<3>::Value three = best.weigh(input);
+        std::cout << "three cheapest:";
+        for (std::size_t i = 0; i < 3; ++i)
+        {
+            std::cout << " " << three[i];
+        }
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,81 @@
+#include <derp/Language.hpp>
+#include <derp/Lexer.hpp>
+#include <derp/Pipeline.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main()
+{
+    using Language = derp::Language<char>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    using Grammar = derp::Language<unsigned int>;
+    using GrammarGC = Grammar::GarbageCollector;
+    using GrammarFactory = derp::Factory<Grammar>;
+
+    GC gc;
+    Factory F(gc);
+
+    // The tokens of samples/recognizing/sexp.cpp, in order of priority
+    enum : unsigned int { OPEN, CLOSE, SYMBOL, NUMBER, BOOLEAN, WHITESPACE };
+    Language digit = F.range('0', '9');
+    const std::vector<Language> tokens = {
+        F('('),
+        F(')'),
+        +(F('_') | F.range('a', 'z') | F.range('A', 'Z')),
+        -F('-') & *digit & -F('.') & +digit,
+        F("#t") | "#f",
+        +(F(' ') | '\r' | '\n' | '\t')
+    };
+    derp::Lexer<Language> lexer(tokens, {WHITESPACE});
+
+    // sexp = SYMBOL | NUMBER | BOOLEAN | OPEN sexp* CLOSE
+    GrammarGC ggc;
+    GrammarFactory G(ggc);
+    Grammar sexp = G();
+    sexp = G(SYMBOL) | G(NUMBER) | G(BOOLEAN) | (G(OPEN) & *sexp & G(CLOSE));
+
+    derp::Pipeline<Language, Grammar> pipeline(lexer, sexp);
+
+    // The same language, a byte at a time
+    Language whitespace = *(F(' ') | '\r' | '\n' | '\t');
+    Language atom = tokens[SYMBOL] | tokens[NUMBER] | tokens[BOOLEAN];
+    Language bytes = F();
+    bytes = atom | ('(' & whitespace & *(bytes & whitespace) & ')');
+
+    std::cout << "input (empty for a generated one): " << std::flush;
+
+    std::string input;
+    std::getline(std::cin, input);
+    if (input.empty())
+    {
+        input = "(";
+        for (int i = 0; i < 20000; ++i)
+        {
+            input += "(abc -12.5 #t (x y) 42) ";
+        }
+        input += ")";
+    }
+
+    auto time = [&](const char* name, bool threaded)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool matched = pipeline.matches(input, threaded);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << name << ": " << (matched ? "matches" : "doesn't match") << " in " << elapsed.count() << "s";
+        if (pipeline.error() != std::string::npos) std::cout << " (no token at byte " << pipeline.error() << ")";
+        std::cout << std::endl;
+    };
+
+    time("lexer, then grammar", false);
+    time("lexer and grammar on two threads", true);
+
+    auto start = std::chrono::steady_clock::now();
+    bool matched = derp::matches(input, bytes);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "grammar of bytes: " << (matched ? "matches" : "doesn't match") << " in " << elapsed.count() << "s" << std::endl;
+}
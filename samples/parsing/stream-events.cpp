@@ -0,0 +1,69 @@
+#include <derp/Language.hpp>
+#include <derp/StreamParser.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Prints each named language as it starts and ends, indented by depth
+struct Printer
+{
+    std::size_t depth = 0;
+
+    void enter(const std::string& name, std::size_t offset)
+    {
+        std::cout << std::string(depth * 2, ' ') << name << " @" << offset << std::endl;
+        ++depth;
+    }
+
+    void exit(const std::string& name, std::size_t offset)
+    {
+        --depth;
+        std::cout << std::string(depth * 2, ' ') << "/" << name << " @" << offset << std::endl;
+    }
+};
+
+int main()
+{
+    using Language = derp::Language<char>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    GC gc;
+    Factory F(gc);
+
+    // digit = [0-9]
+    // number = digit+
+    Language digit = F('0') | '1' | '2' | '3' | '4' | '5' | '6' | '7' | '8' | '9';
+    Language number = +digit;
+
+    // whitespace = [ \r\n\t]*
+    Language whitespace = *(F(' ') | '\r' | '\n' | '\t');
+
+    // list = '[' whitespace (item (whitespace ',' whitespace item)*)? whitespace ']'
+    // item = number | list
+    Language list = F();
+    Language item = F();
+    list = '[' & whitespace & -(item & *(whitespace & ',' & whitespace & item)) & whitespace & ']';
+    item = number | list;
+
+    const std::vector<std::pair<Language, std::string>> names = {
+        {number, "number"},
+        {list, "list"},
+    };
+
+    Printer printer;
+    derp::StreamParser<Language, Printer> parser(list, names, printer);
+
+    // Events are printed while the input is still being read, as soon as they are certain
+    std::cout << "nested list of numbers (end with EOF): " << std::endl;
+
+    char buffer[64];
+    while (std::cin.read(buffer, sizeof(buffer)) || std::cin.gcount() != 0)
+    {
+        if (!parser.feed(buffer, static_cast<std::size_t>(std::cin.gcount()))) break;
+    }
+
+    bool matched = parser.finish();
+    std::cout << (matched ? "match" : "no match") << " after " << parser.offset() << " bytes" << std::endl;
+}
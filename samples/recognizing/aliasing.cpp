@@ -0,0 +1,35 @@
+#include <derp/Language.hpp>
+
+#include <cstdlib>
+#include <iostream>
+
+using Language = derp::Language<char>;
+using GC = Language::GarbageCollector;
+using Factory = derp::Factory<Language>;
+
+// Returns a handle to the same node as language
+Language pick(const Language& language)
+{
+    return language;
+}
+
+// Assigning from a temporary handle must leave every other handle to its node intact
+int main()
+{
+    GC gc;
+    Factory F(gc);
+
+    Language abc = F('a') & F('b') & F('c');
+    Language either = F('x') | F('y') | F('z');
+
+    Language x = F();
+    Language y = F();
+    x = pick(abc);
+    y = pick(either);
+
+    bool correct = derp::matches("abc", abc) && derp::matches("abc", x) && !derp::matches("ab", abc)
+                && derp::matches("y", either) && derp::matches("z", y) && !derp::matches("w", either);
+
+    std::cout << (correct ? "both handles still match" : "a handle was emptied") << std::endl;
+    return correct ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,47 @@
+#include <derp/Language.hpp>
+#include <derp/Matcher.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+int main()
+{
+    using Language = derp::Language<char>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    GC gc;
+    Factory F(gc);
+
+    // digit = [0-9]
+    // number = '-'? digit+ ('.' digit+)?
+    Language digit = F('0') | '1' | '2' | '3' | '4' | '5' | '6' | '7' | '8' | '9';
+    Language number = -F('-') & +digit & -(F('.') & +digit);
+
+    // Keep up to 4096 nodes of derivatives by common field prefixes
+    derp::Matcher<Language> matcher(number, 4096);
+
+    std::cout << "comma separated fields: " << std::flush;
+
+    std::string line;
+    std::getline(std::cin, line);
+
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    for (std::string field; std::getline(stream, field, ',');)
+    {
+        fields.push_back(field);
+    }
+
+    std::vector<bool> numeric = matcher.matchAll(fields);
+    for (std::size_t i = 0; i < fields.size(); ++i)
+    {
+        std::cout << "\"" << fields[i] << "\": " << (numeric[i] ? "number" : "not a number") << std::endl;
+    }
+
+    const derp::PrefixCacheStats& stats = matcher.cacheStats();
+    std::cout << matcher.byteClasses() << " byte classes, prefix cache: " << stats.hits << " of " << stats.lookups << " fields resumed, " <<
+        stats.skipped << " bytes not derived" << std::endl;
+}
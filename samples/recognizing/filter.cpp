@@ -0,0 +1,38 @@
+#include <derp/Language.hpp>
+
+#include <iostream>
+#include <string>
+
+int main()
+{
+    using Language = derp::Language<char>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    GC gc;
+    Factory F(gc);
+
+    // character = .
+    // any = character*
+    // username = [a-z] [a-z0-9_]*
+    Language character = F.except({});
+    Language any = *character;
+    Language username = F.range('a', 'z') & *F.ranges({{'a', 'z'}, {'0', '9'}, {'_', '_'}});
+
+    // tooLong = character{17} any
+    Language tooLong = character & character & character & character & character & character & character & character &
+        character & character & character & character & character & character & character & character & character & any;
+
+    // reserved = any ("admin" | "root") any
+    Language reserved = any & (F("admin") | "root") & any;
+
+    // allowed = username && !tooLong && !reserved
+    Language allowed = username && !tooLong && !reserved;
+
+    std::cout << "input: " << std::flush;
+
+    std::string input;
+    std::getline(std::cin, input);
+
+    std::cout << "match: " << (derp::matches(input, allowed) ? "true" : "false") << std::endl;
+}
@@ -0,0 +1,51 @@
+#include <derp/Language.hpp>
+#include <derp/MultiMatcher.hpp>
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+int main()
+{
+    using Language = derp::Language<char>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    GC gc;
+    Factory F(gc);
+
+    // digit = [0-9]
+    // whitespace = [ \t]*
+    Language digit = F('0') | '1' | '2' | '3' | '4' | '5' | '6' | '7' | '8' | '9';
+    Language whitespace = *(F(' ') | '\t');
+
+    // integer = whitespace digit+ whitespace
+    // decimal = whitespace digit+ '.' digit+ whitespace
+    // boolean = whitespace ("true" | "false") whitespace
+    Language integer = whitespace & +digit & whitespace;
+    Language decimal = whitespace & +digit & '.' & +digit & whitespace;
+    Language boolean = whitespace & (F("true") | "false") & whitespace;
+
+    std::unordered_map<Language, std::string> names = {
+        {integer, "integer"},
+        {decimal, "decimal"},
+        {boolean, "boolean"}
+    };
+
+    derp::MultiMatcher<Language> matcher(gc);
+    matcher.insert(integer);
+    matcher.insert(decimal);
+    matcher.insert(boolean);
+
+    std::cout << "input: " << std::flush;
+
+    std::string input;
+    std::getline(std::cin, input);
+
+    std::cout << "matches:";
+    for (const Language& l : matcher.matches(input))
+    {
+        std::cout << " " << names.at(l);
+    }
+    std::cout << std::endl;
+}
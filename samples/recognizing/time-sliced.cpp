@@ -0,0 +1,148 @@
+#include <derp/Language.hpp>
+#include <derp/Session.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using Language = derp::Language<char>;
+using GC = Language::GarbageCollector;
+using Factory = derp::Factory<Language>;
+using Clock = std::chrono::steady_clock;
+
+// Appends a random list nested up to depth levels deep
+void generate(std::string& out, std::mt19937& rng, int depth)
+{
+    out += '(';
+    for (int i = 0, n = rng() % 5; i < n; ++i)
+    {
+        if (i != 0) out += ' ';
+        if (depth > 0 && rng() % 3 == 0)
+        {
+            generate(out, rng, depth - 1);
+        }
+        else
+        {
+            out += (rng() % 2) ? "abc" : "42";
+        }
+    }
+    out += ')';
+}
+
+// Any one of words [begin, end), as a balanced tree of unions
+Language oneOf(Factory& F, const std::vector<std::string>& words, std::size_t begin, std::size_t end)
+{
+    if (end - begin == 1) return F(words[begin]);
+
+    std::size_t middle = begin + (end - begin) / 2;
+    return oneOf(F, words, begin, middle) | oneOf(F, words, middle, end);
+}
+
+// Usage: time-sliced [microseconds]
+//
+// Matches a few large inputs the way an event loop would: each turn of the loop steps
+// one session for at most the given time (100us by default), round robin, until every
+// session is done. Reports the median and the longest a step took, and the same in
+// processor time, as wall clock time also counts being preempted. The keyword inputs
+// have tokens that take tens of microseconds (the first byte of each word derives every
+// keyword), which a step gives up on and leaves to the next once its slice runs out.
+int main(int argc, char** argv)
+{
+    std::chrono::microseconds slice((argc > 1) ? std::strtol(argv[1], nullptr, 10) : 100);
+
+    GC gc;
+    Factory F(gc);
+
+    // sexp = atom | list
+    // list = '(' (sexp (' ' sexp)*)? ')'
+    Language atom = +F.range('a', 'z') | +F.range('0', '9');
+    Language sexp = F();
+    Language list = F();
+    sexp = atom | list;
+    list = F('(') & -(sexp & *(F(' ') & sexp)) & ')';
+    Language document = *(sexp & '\n');
+
+    std::mt19937 rng(7);
+    std::vector<std::string> inputs(4);
+    for (std::string& input : inputs)
+    {
+        while (input.size() < 50000)
+        {
+            generate(input, rng, 8);
+            input += '\n';
+        }
+    }
+    inputs[1][inputs[1].size() / 2] = '#';
+
+    // keywords = (keyword ' ')*, with 300 random keywords
+    std::vector<std::string> keywords(300);
+    for (std::string& keyword : keywords)
+    {
+        for (int i = 0, n = 3 + rng() % 8; i < n; ++i) keyword += static_cast<char>('a' + rng() % 26);
+    }
+    Language keyword = oneOf(F, keywords, 0, keywords.size());
+    Language text = *(keyword & ' ');
+
+    std::vector<std::string> keywordInputs(2);
+    for (std::string& input : keywordInputs)
+    {
+        while (input.size() < 50000)
+        {
+            input += keywords[rng() % keywords.size()];
+            input += ' ';
+        }
+    }
+
+    std::vector<std::unique_ptr<derp::Session<Language>>> sessions;
+    for (const std::string& input : inputs)
+    {
+        sessions.emplace_back(new derp::Session<Language>(document, input));
+    }
+    for (const std::string& input : keywordInputs)
+    {
+        sessions.emplace_back(new derp::Session<Language>(text, input));
+    }
+
+    std::vector<double> steps;
+    std::vector<double> cpuSteps;
+    for (bool busy = true; busy;)
+    {
+        busy = false;
+        for (auto& session : sessions)
+        {
+            if (session->status() != derp::Session<Language>::SUSPENDED) continue;
+
+            Clock::time_point start = Clock::now();
+            std::clock_t cpu = std::clock();
+            busy |= session->step(derp::Budget::ofTime(slice)) == derp::Session<Language>::SUSPENDED;
+            std::clock_t cpuEnd = std::clock();
+            Clock::time_point end = Clock::now();
+            steps.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+            cpuSteps.push_back(1e6 * (cpuEnd - cpu) / CLOCKS_PER_SEC);
+        }
+    }
+
+    std::sort(steps.begin(), steps.end());
+    std::sort(cpuSteps.begin(), cpuSteps.end());
+    std::size_t over = steps.end() - std::upper_bound(steps.begin(), steps.end(), 2.0 * slice.count());
+    std::cout << steps.size() << " steps; median " << steps[steps.size() / 2] << "us, longest "
+              << steps.back() << "us, " << over << " over twice the slice" << std::endl;
+    std::cout << "processor time: median " << cpuSteps[cpuSteps.size() / 2] << "us, 99th percentile "
+              << cpuSteps[cpuSteps.size() * 99 / 100] << "us, longest " << cpuSteps.back() << "us" << std::endl;
+
+    bool correct = true;
+    for (std::size_t s = 0; s < sessions.size(); ++s)
+    {
+        bool matched = sessions[s]->status() == derp::Session<Language>::MATCHED;
+        std::cout << "input " << s << ": " << (matched ? "matched" : "failed") << " after " << sessions[s]->offset() << " bytes" << std::endl;
+        correct &= matched == (s != 1);
+    }
+
+    return correct ? EXIT_SUCCESS : EXIT_FAILURE;
+}
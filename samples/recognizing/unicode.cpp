@@ -0,0 +1,45 @@
+#include <derp/Language.hpp>
+#include <derp/Utf8Matcher.hpp>
+
+#include <iostream>
+#include <string>
+
+int main()
+{
+    using Language = derp::Language<char32_t>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    GC gc;
+    Factory F(gc);
+
+    // greek = [Α-Ωα-ω]+
+    // han = [一-鿿]+
+    // word = greek | han
+    // text = word (' ' word)*
+    Language greek = +F.ranges({{U'Α', U'Ω'}, {U'α', U'ω'}});
+    Language han = +F.range(U'一', U'鿿');
+    Language word = greek | han;
+    Language text = word & *(F(U' ') & word);
+
+    derp::Utf8Matcher<Language> matcher(text);
+
+    std::cout << "Enter Greek or Chinese words, separated by spaces" << std::endl;
+
+    std::string input;
+    while (std::getline(std::cin, input))
+    {
+        if (matcher.matches(input))
+        {
+            std::cout << "matches" << std::endl;
+        }
+        else if (matcher.error() != std::string::npos)
+        {
+            std::cout << "invalid UTF-8 at byte " << matcher.error() << std::endl;
+        }
+        else
+        {
+            std::cout << "doesn't match" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#include <derp/Language.hpp>
+#include <derp/Trace.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using Language = derp::Language<char>;
+using GC = Language::GarbageCollector;
+using Factory = derp::Factory<Language>;
+
+// Tokens left out of the counts while the derivative grows to its steady shape
+static const std::size_t WARM_UP = 100;
+
+// Matches input, counting the nodes each token allocates and how many of those the new
+// derivative still reaches once it is built. Every other one was a placeholder, or a
+// node that compaction replaced, and was thrown away within the token. Ideally none are,
+// but deriving does not get there yet: a composite child still gets a LAZY placeholder
+// that force() overwrites with its derivative, and compact() overwrites a node it
+// simplifies. So this checks that neither the allocations nor the discarded nodes per
+// token grow past what they are today, and reports failures in the exit status.
+static bool check(GC& gc, const char* name, const Language& language, const std::string& input, double allocationLimit, double discardLimit)
+{
+    derp::Trace<Language> trace(gc);
+    bool matched = trace.matches(input, language);
+
+    std::size_t tokens = 0;
+    std::size_t allocations = 0;
+    std::size_t fresh = 0;
+    for (const derp::TraceStep& step : trace.steps())
+    {
+        if (step.position < WARM_UP) continue;
+        ++tokens;
+        allocations += step.allocations;
+        fresh += step.fresh;
+    }
+
+    double allocated = static_cast<double>(allocations) / tokens;
+    double survived = static_cast<double>(fresh) / tokens;
+    double discarded = allocated - survived;
+    std::printf("%-12s %8zu tokens %8.2f allocated/token %8.2f survived/token %8.2f discarded/token\n", name, tokens,
+        allocated, survived, discarded);
+
+    bool ok = true;
+    if (!matched)
+    {
+        std::printf("  input not matched FAILED\n");
+        ok = false;
+    }
+    if (allocated > allocationLimit)
+    {
+        std::printf("  more than %.2f allocated/token FAILED\n", allocationLimit);
+        ok = false;
+    }
+    if (discarded > discardLimit)
+    {
+        std::printf("  more than %.2f discarded/token FAILED\n", discardLimit);
+        ok = false;
+    }
+
+    return ok;
+}
+
+int main()
+{
+    GC gc;
+    Factory F(gc);
+
+    // identifiers = [a-z]+ (',' [a-z]+)*
+    Language identifier = +F.range('a', 'z');
+    Language identifiers = identifier & *(',' & identifier);
+
+    // sexp = identifier | '(' ' '* (sexp ' '*)* ')'
+    Language sexp = F();
+    Language whitespace = *F(' ');
+    sexp = identifier | ('(' & whitespace & *(sexp & whitespace) & ')');
+
+    // value = '[' (value (',' value)*)? ']' | "true" | "null"
+    Language value = F();
+    value = ('[' & -(value & *(',' & value)) & ']') | "true" | "null";
+
+    std::string list = "alpha";
+    while (list.size() < 10000) list += ",beta,gamma";
+
+    std::string tree = "(define";
+    for (int i = 0; i < 500; ++i) tree += " (f (g x y) z)";
+    tree += ")";
+
+    std::string array = "[[true,[null]]";
+    for (int i = 0; i < 500; ++i) array += ",[true,[null]]";
+    array += "]";
+
+    // The limits leave some room over what deriving costs today, to catch regressions
+    bool ok = true;
+    ok &= check(gc, "identifiers", identifiers, list, 8, 7);
+    ok &= check(gc, "sexp", sexp, tree, 32, 24);
+    ok &= check(gc, "value", value, array, 12, 8);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
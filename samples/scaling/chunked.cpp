@@ -0,0 +1,58 @@
+#include <derp/ChunkedMatcher.hpp>
+#include <derp/Language.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+using Language = derp::Language<char>;
+using GC = Language::GarbageCollector;
+using Factory = derp::Factory<Language>;
+
+int main()
+{
+    GC gc;
+    Factory F(gc);
+
+    // pair = [a-z]+ '=' [0-9]+
+    // line = pair (';' pair)* '\n'
+    // log = line*
+    Language pair = +F.range('a', 'z') & '=' & +F.range('0', '9');
+    Language line = pair & *(';' & pair) & '\n';
+    Language log = *line;
+
+    std::mt19937 rng(1);
+    std::string input;
+    while (input.size() < (4 << 20))
+    {
+        for (std::size_t p = 0, pairs = 1 + rng() % 4; p < pairs; ++p)
+        {
+            if (p != 0) input += ';';
+            for (std::size_t i = 0, n = 1 + rng() % 8; i < n; ++i) input += static_cast<char>('a' + rng() % 26);
+            input += '=';
+            for (std::size_t i = 0, n = 1 + rng() % 5; i < n; ++i) input += static_cast<char>('0' + rng() % 10);
+        }
+        input += '\n';
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool matched = derp::matches(input, log);
+    std::chrono::duration<double> serial = std::chrono::steady_clock::now() - start;
+    std::cout << input.size() << " bytes" << std::endl;
+    std::cout << "  derivatives: " << serial.count() << "s" << (matched ? "" : " (not matched)") << std::endl;
+
+    std::cout << "  (" << std::thread::hardware_concurrency() << " hardware threads)" << std::endl;
+    for (unsigned int threads : {1, 2, 4, 8, 16})
+    {
+        derp::ChunkedMatcher<Language> matcher(log, threads);
+
+        start = std::chrono::steady_clock::now();
+        matched = matcher.matches(input);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "  " << threads << " threads, " << matcher.states() << " states: " << elapsed.count() << "s, " <<
+            serial.count() / elapsed.count() << "x" << (matched ? "" : " (not matched)") << std::endl;
+    }
+}
@@ -0,0 +1,175 @@
+#include <derp/Language.hpp>
+#include <derp/Trace.hpp>
+
+#include <cmath>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Language = derp::Language<char>;
+using GC = Language::GarbageCollector;
+using Factory = derp::Factory<Language>;
+
+// Builds a grammar in the given collector and returns it with an input of (about) the
+// given size that it matches
+typedef std::function<Language (GC& gc, std::size_t size, std::string& input)> Case;
+
+// Matches inputs of increasing size and checks that the work done (derivations plus
+// allocations, which unlike time does not depend on the machine) grows no faster than
+// size^bound between any two consecutive sizes. Work misses what building unions costs,
+// so processor time is checked too, between the smallest and the largest size, where
+// noise shifts the exponent least. Failures are reported in the exit status rather
+// than asserted, so they are caught in release builds too.
+static bool check(const std::string& name, const Case& build, const std::vector<std::size_t>& sizes, double bound)
+{
+    std::cout << name << " (at most n^" << bound << ")" << std::endl;
+
+    bool ok = true;
+    double previousSize = 0;
+    double previousWork = 0;
+    double firstSize = 0;
+    double firstSeconds = 0;
+    double seconds = 0;
+    for (std::size_t size : sizes)
+    {
+        GC gc;
+        std::string input;
+        Language language = build(gc, size, input);
+
+        derp::Trace<Language> trace(gc);
+        std::clock_t start = std::clock();
+        bool matched = trace.matches(input, language);
+        seconds = static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+
+        double work = 0;
+        for (const derp::TraceStep& step : trace.steps())
+        {
+            work += step.derives + step.allocations;
+        }
+
+        std::cout << "  n = " << input.size() << ": " << work << " work, " << seconds << "s";
+        if (previousWork > 0)
+        {
+            double exponent = std::log(work / previousWork) / std::log(input.size() / previousSize);
+            std::cout << ", n^" << exponent;
+
+            // Allow for lower order terms at small sizes
+            if (exponent > bound + 0.25)
+            {
+                std::cout << " FAILED";
+                ok = false;
+            }
+        }
+        std::cout << std::endl;
+
+        if (!matched)
+        {
+            std::cout << "  input not matched FAILED" << std::endl;
+            ok = false;
+        }
+
+        if (firstSize == 0)
+        {
+            firstSize = input.size();
+            firstSeconds = seconds;
+        }
+        previousSize = input.size();
+        previousWork = work;
+    }
+
+    double exponent = std::log(seconds / firstSeconds) / std::log(previousSize / firstSize);
+    std::cout << "  time grew as n^" << exponent;
+    if (exponent > bound + 0.25)
+    {
+        std::cout << " FAILED";
+        ok = false;
+    }
+    std::cout << std::endl;
+
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+
+    // l = l ("foo" | "bar") | ""
+    ok &= check("left recursive list", [](GC& gc, std::size_t size, std::string& input)
+    {
+        Factory F(gc);
+        Language l = F();
+        l = (l & (F("foo") | "bar")) | "";
+        for (std::size_t i = 0; i < size / 3; ++i) input += (i % 2) ? "foo" : "bar";
+        return l;
+    }, {1000, 10000, 100000}, 1);
+
+    // s = '(' s ')' s | ""
+    ok &= check("right recursive parentheses", [](GC& gc, std::size_t size, std::string& input)
+    {
+        Factory F(gc);
+        Language s = F();
+        s = ('(' & s & ')' & s) | "";
+        for (std::size_t i = 0; i < size / 2; ++i) input += "()";
+        return s;
+    }, {1000, 10000, 100000}, 1);
+
+    // s = 'a' s 'b' | ""
+    ok &= check("nested", [](GC& gc, std::size_t size, std::string& input)
+    {
+        Factory F(gc);
+        Language s = F();
+        s = ('a' & s & 'b') | "";
+        input = std::string(size / 2, 'a') + std::string(size / 2, 'b');
+        return s;
+    }, {500, 1000, 2000, 4000}, 2);
+
+    // s = '[' list ']' | 'x', list = s ',' list | s
+    ok &= check("nested lists", [](GC& gc, std::size_t size, std::string& input)
+    {
+        Factory F(gc);
+        Language s = F();
+        Language list = F();
+        s = ('[' & list & ']') | 'x';
+        list = (s & ',' & list) | s;
+        input = "x";
+        while (input.size() + 4 <= size) input = "[x," + input + "]";
+        return s;
+    }, {500, 1000, 2000, 4000}, 2);
+
+    // Why ambiguous grammars stay within n^3: memos make each derivation derive every
+    // node of the derivative at most once, and every node the ith derivative holds is
+    // the derivative of some grammar node since some position j <= i (where a sequence
+    // split off its nullable left part), so it holds at most |G| (i + 1) nodes. An
+    // ambiguous grammar can make a node a union of up to i + 1 alternatives, one per
+    // split point, so building (and solving the nullability of) the ith derivative
+    // takes O(|G| i^2) steps, and the whole match O(|G| n^3). Derivations and
+    // allocations stay near n^2 here; the rest is in merging the unions' children,
+    // which only the time shows. Unambiguous grammars keep a constant number of
+    // alternatives per node, hence the n^1 and n^2 above.
+
+    // Highly ambiguous: s = s s | '(' s ')' | ""
+    ok &= check("ambiguous parentheses", [](GC& gc, std::size_t size, std::string& input)
+    {
+        Factory F(gc);
+        Language s = F();
+        s = (s & s) | ('(' & s & ')') | "";
+        for (std::size_t i = 0; i < size / 2; ++i) input += "()";
+        return s;
+    }, {128, 256, 512, 1024}, 3);
+
+    // Highly ambiguous: e = e '+' e | 'x'
+    ok &= check("ambiguous sums", [](GC& gc, std::size_t size, std::string& input)
+    {
+        Factory F(gc);
+        Language e = F();
+        e = (e & '+' & e) | 'x';
+        input = "x";
+        while (input.size() + 2 <= size) input += "+x";
+        return e;
+    }, {128, 256, 512, 1024}, 3);
+
+    std::cout << (ok ? "all cases within bounds" : "some cases exceeded their bounds") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include <derp/Language.hpp>
+#include <derp/PredictiveMatcher.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+using Language = derp::Language<char>;
+using GC = Language::GarbageCollector;
+using Factory = derp::Factory<Language>;
+
+// Appends a random value nested up to depth levels deep
+void generate(std::string& out, std::mt19937& rng, int depth)
+{
+    switch (depth > 0 ? rng() % 6 : 2 + rng() % 4)
+    {
+        case 0:
+            out += "{ ";
+            for (unsigned int i = 0, n = rng() % 5; i < n; ++i)
+            {
+                if (i != 0) out += ", ";
+                out += "\"key" + std::to_string(i) + "\": ";
+                generate(out, rng, depth - 1);
+            }
+            out += "}";
+            break;
+        case 1:
+            out += "[";
+            for (unsigned int i = 0, n = rng() % 5; i < n; ++i)
+            {
+                if (i != 0) out += ",\n";
+                generate(out, rng, depth - 1);
+            }
+            out += "]";
+            break;
+        case 2: out += "\"some text\""; break;
+        case 3: out += std::to_string(static_cast<int>(rng() % 20000) - 10000); break;
+        case 4: out += "true"; break;
+        default: out += "null"; break;
+    }
+}
+
+int main()
+{
+    GC gc;
+    Factory F(gc);
+
+    // ws = [ \n]*
+    // value = object | array | string | number | "true" | "false" | "null"
+    // object = '{' ws (pair (',' ws pair)*)? '}'
+    // pair = string ws ':' ws value ws
+    // array = '[' ws (value ws (',' ws value ws)*)? ']'
+    // Every choice but the one in number is decided by the next byte
+    Language ws = *(F(' ') | '\n');
+    Language digit = F('0') | '1' | '2' | '3' | '4' | '5' | '6' | '7' | '8' | '9';
+    Language letter = F('a') | 'e' | 'm' | 'o' | 's' | 't' | 'x' | 'y' | 'k' | ' ' | '0' | '1' | '2' | '3' | '4';
+    Language string = '"' & *letter & '"';
+
+    // Both the optional sign and the first digit can be followed by a digit
+    Language number = -F('-') & *digit & digit;
+
+    Language value = F();
+    Language pair = string & ws & ':' & ws & value & ws;
+    Language object = '{' & ws & -(pair & *(',' & ws & pair)) & '}';
+    Language array = '[' & ws & -(value & ws & *(',' & ws & value & ws)) & ']';
+    value = object | array | string | number | "true" | "false" | "null";
+
+    std::mt19937 rng(1);
+    std::string input = "[";
+    while (input.size() < 100000)
+    {
+        if (input.size() > 1) input += ", ";
+        generate(input, rng, 4);
+    }
+    input += "]";
+
+    auto start = std::chrono::steady_clock::now();
+    bool matched = derp::matches(input, value);
+    std::chrono::duration<double> derived = std::chrono::steady_clock::now() - start;
+    std::cout << input.size() << " bytes" << std::endl;
+    std::cout << "  derivatives: " << derived.count() << "s" << (matched ? "" : " (not matched)") << std::endl;
+
+    derp::PredictiveMatcher<Language> matcher(value);
+    start = std::chrono::steady_clock::now();
+    matched = matcher.matches(input);
+    std::chrono::duration<double> predicted = std::chrono::steady_clock::now() - start;
+    std::cout << "  predictive: " << predicted.count() << "s, " << derived.count() / predicted.count() << "x" <<
+        (matched ? "" : " (not matched)") << std::endl;
+
+    const derp::PredictiveStats& stats = matcher.stats();
+    std::cout << "  " << stats.predicted << " bytes predicted, " << stats.derived << " derived, " <<
+        stats.fallbacks << " fallbacks, " << stats.resumes << " resumes" << std::endl;
+}
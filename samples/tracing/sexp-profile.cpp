@@ -0,0 +1,66 @@
+#include <derp/Language.hpp>
+#include <derp/Profile.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+int main()
+{
+    using Language = derp::Language<char>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    GC gc;
+    Factory F(gc);
+
+    // The grammar from samples/tracing/sexp-trace.cpp
+    Language alpha = F('_') | 'a' | 'b' | 'c' | 'x' | 'y' | 'z';
+    Language symbol = +alpha;
+    Language digit = F('0') | '1' | '2' | '3' | '4' | '5' | '6' | '7' | '8' | '9';
+    Language number = -F('-') & *digit & -F('.') & +digit;
+    Language boolean = F("#t") | "#f";
+    Language whitespace = *(F(' ') | '\r' | '\n' | '\t');
+    Language atom = symbol | number | boolean;
+    Language sexplist = F();
+    Language sexp = F();
+    sexplist = (sexp & whitespace & sexplist) | "";
+    sexp = atom | (F('(') & whitespace & sexplist & whitespace & ')');
+
+    const std::vector<std::pair<Language, std::string>> names = {
+        {alpha, "alpha"},
+        {symbol, "symbol"},
+        {digit, "digit"},
+        {number, "number"},
+        {boolean, "boolean"},
+        {whitespace, "whitespace"},
+        {atom, "atom"},
+        {sexplist, "sexplist"},
+        {sexp, "sexp"}
+    };
+
+    std::cout << "input (empty for a generated one): " << std::flush;
+
+    std::string input;
+    std::getline(std::cin, input);
+    if (input.empty())
+    {
+        input = "(";
+        for (int i = 0; i < 2000; ++i)
+        {
+            input += "(abc -12.5 #t (x y) 42) ";
+        }
+        input += ")";
+    }
+
+    derp::Profile<Language> profile(gc);
+    std::cout << "matches? " << profile.matches(input, sexp, names) << std::endl;
+    std::cout << profile.report();
+
+    // Render with: flamegraph.pl sexp.folded > sexp.svg (or load it in speedscope)
+    std::ofstream("sexp.folded") << profile.toFolded();
+
+    std::cout << "wrote sexp.folded" << std::endl;
+}
@@ -0,0 +1,59 @@
+#include <derp/Language.hpp>
+#include <derp/Trace.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+int main()
+{
+    using Language = derp::Language<char>;
+    using GC = Language::GarbageCollector;
+    using Factory = derp::Factory<Language>;
+
+    GC gc;
+    Factory F(gc);
+
+    // The grammar from samples/recognizing/sexp.cpp, with a smaller alphabet
+    Language alpha = F('_') | 'a' | 'b' | 'c' | 'x' | 'y' | 'z';
+    Language symbol = +alpha;
+    Language digit = F('0') | '1' | '2' | '3' | '4' | '5' | '6' | '7' | '8' | '9';
+    Language number = -F('-') & *digit & -F('.') & +digit;
+    Language boolean = F("#t") | "#f";
+    Language whitespace = *(F(' ') | '\r' | '\n' | '\t');
+    Language atom = symbol | number | boolean;
+    Language sexplist = F();
+    Language sexp = F();
+    sexplist = (sexp & whitespace & sexplist) | "";
+    sexp = atom | (F('(') & whitespace & sexplist & whitespace & ')');
+
+    const std::vector<std::pair<Language, std::string>> names = {
+        {alpha, "alpha"},
+        {symbol, "symbol"},
+        {digit, "digit"},
+        {number, "number"},
+        {boolean, "boolean"},
+        {whitespace, "whitespace"},
+        {sexplist, "sexplist"},
+        {sexp, "sexp"}
+    };
+
+    std::cout << "input: " << std::flush;
+
+    std::string input;
+    std::getline(std::cin, input);
+
+    derp::Trace<Language> trace(gc);
+    std::cout << "matches? " << trace.matches(input, sexp) << std::endl;
+
+    // Per-position statistics, for plotting
+    std::ofstream("trace.csv") << trace.toCsv();
+    std::ofstream("trace.json") << trace.toJson();
+
+    // Render with: dot -Tsvg sexp.dot -o sexp.svg
+    std::ofstream("sexp.dot") << trace.toDot(names);
+
+    std::cout << "wrote trace.csv, trace.json and sexp.dot" << std::endl;
+}